@@ -0,0 +1,53 @@
+#include "bench_rom.hpp"
+#include "../include/vm.hpp"
+#include <benchmark/benchmark.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace
+{
+	constexpr int INSTRUCTIONS_PER_ITERATION = 1000;
+
+	// Stack in working RAM, and HL pointing at working RAM for the (HL) patterns
+	const std::vector<uint8_t> SETUP = {
+		0x31, 0xFE, 0xDF, // LD SP,0xDFFE
+		0x21, 0x00, 0xC0, // LD HL,0xC000
+	};
+
+	/**
+	 * Runs pattern, over and over, through VM::executeInstruction. Reports
+	 * instructions per second
+	 */
+	void opcodeGroup(benchmark::State& state, const std::string& name, std::vector<uint8_t> pattern)
+	{
+		std::string path = gb_bench::writeROM("gb_bench_" + name + ".gb", gb_bench::loopROM(SETUP, pattern));
+		auto vm = std::make_unique<gb_emu::VM>(path);
+		if(!vm->isLoaded()) {
+			state.SkipWithError("can't load the ROM");
+			return;
+		}
+		for(auto _ : state) {
+			for(int i = 0; i < INSTRUCTIONS_PER_ITERATION; ++i) {
+				if(vm->executeInstruction() != gb_emu::ExecuteResult::OK) {
+					state.SkipWithError("instruction not implemented");
+					return;
+				}
+			}
+		}
+		state.SetItemsProcessed(state.iterations() * INSTRUCTIONS_PER_ITERATION);
+	}
+}
+
+// 0x00-0x3F: INC BC, DEC DE, LD C,d8, JR 0
+BENCHMARK_CAPTURE(opcodeGroup, misc1, std::string("misc1"), std::vector<uint8_t>{ 0x03, 0x1B, 0x0E, 0x42, 0x18, 0x00 });
+// 0x40-0x7F between registers: LD B,C, LD D,B, LD H,D, LD A,B
+BENCHMARK_CAPTURE(opcodeGroup, ld_r_r, std::string("ld_r_r"), std::vector<uint8_t>{ 0x41, 0x50, 0x62, 0x78 });
+// 0x40-0x7F through memory: LD (HL),A, LD A,(HL)
+BENCHMARK_CAPTURE(opcodeGroup, ld_hl, std::string("ld_hl"), std::vector<uint8_t>{ 0x77, 0x7E });
+// 0x80-0xBF: ADD A,B, XOR C, OR D, CP B
+BENCHMARK_CAPTURE(opcodeGroup, arith, std::string("arith"), std::vector<uint8_t>{ 0x80, 0xA9, 0xB2, 0xB8 });
+// 0xC0-0xFF: PUSH BC, POP DE, AND d8
+BENCHMARK_CAPTURE(opcodeGroup, misc2, std::string("misc2"), std::vector<uint8_t>{ 0xC5, 0xD1, 0xE6, 0x0F });
+// 0xCB prefix: SWAP A, RL B
+BENCHMARK_CAPTURE(opcodeGroup, prefix_cb, std::string("prefix_cb"), std::vector<uint8_t>{ 0xCB, 0x37, 0xCB, 0x10 });
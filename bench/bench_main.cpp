@@ -0,0 +1,28 @@
+#include <benchmark/benchmark.h>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/**
+ * Google Benchmark's own main, except results are also written as JSON
+ * to gb_bench.json unless --benchmark_out says where to put them
+ */
+int main(int argc, char** argv)
+{
+	std::vector<char*> args(argv, argv + argc);
+	std::string out = "--benchmark_out=gb_bench.json";
+	std::string format = "--benchmark_out_format=json";
+	bool outGiven = false;
+	for(int i = 1; i < argc; ++i)
+		outGiven |= std::strncmp(argv[i], "--benchmark_out=", 16) == 0;
+	if(!outGiven) {
+		args.push_back(&out[0]);
+		args.push_back(&format[0]);
+	}
+
+	int count = static_cast<int>(args.size());
+	benchmark::Initialize(&count, args.data());
+	if(benchmark::ReportUnrecognizedArguments(count, args.data())) return 1;
+	benchmark::RunSpecifiedBenchmarks();
+	return 0;
+}
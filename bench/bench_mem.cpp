@@ -0,0 +1,106 @@
+#include "bench_rom.hpp"
+#include "../include/mem.hpp"
+#include <benchmark/benchmark.h>
+#include <memory>
+#include <string>
+
+namespace
+{
+	// Addresses per iteration, within a region (OAM is the smallest, at 160 bytes)
+	constexpr uint16_t SPAN = 128;
+	constexpr size_t MBC1_BANKS = 64;
+
+	std::unique_ptr<gb_emu::MMU> loadedMMU(size_t banks, uint8_t cartridgeType)
+	{
+		std::string path = gb_bench::writeROM("gb_bench_mem_" + std::to_string(banks) + ".gb",
+			gb_bench::blankROM(banks, cartridgeType));
+		auto mmu = std::make_unique<gb_emu::MMU>();
+		mmu->loadFromFile(path);
+		return mmu;
+	}
+
+	/**
+	 * Reads SPAN bytes from base. Reports bytes per second
+	 */
+	void getByte(benchmark::State& state, uint16_t base)
+	{
+		auto mmu = loadedMMU(2, 0);
+		for(auto _ : state) {
+			uint32_t sum = 0;
+			for(uint16_t i = 0; i < SPAN; ++i)
+				sum += mmu->getByte(base + i);
+			benchmark::DoNotOptimize(sum);
+		}
+		state.SetItemsProcessed(state.iterations() * SPAN);
+	}
+
+	/**
+	 * Writes SPAN bytes from base. Reports bytes per second
+	 */
+	void setByte(benchmark::State& state, uint16_t base)
+	{
+		auto mmu = loadedMMU(2, 0);
+		uint8_t value = 0;
+		for(auto _ : state) {
+			for(uint16_t i = 0; i < SPAN; ++i)
+				mmu->setByte(base + i, value);
+			++value;
+			benchmark::ClobberMemory();
+		}
+		state.SetItemsProcessed(state.iterations() * SPAN);
+	}
+
+	/**
+	 * Selects each switchable bank of an MBC1 cartridge in turn and reads
+	 * from it. Reports switches per second
+	 */
+	void mbc1BankSwitch(benchmark::State& state)
+	{
+		auto mmu = loadedMMU(MBC1_BANKS, 0x01);
+		uint8_t bank = 1;
+		for(auto _ : state) {
+			mmu->setByte(0x2000, bank);
+			benchmark::DoNotOptimize(mmu->getByte(gb_emu::SWITCHABLE_ROM_BANK));
+			bank = bank == MBC1_BANKS - 1 ? 1 : bank + 1;
+		}
+		state.SetItemsProcessed(state.iterations());
+	}
+
+	/**
+	 * Loads a ROM of state.range(0) banks. Reports bytes per second
+	 */
+	void loadROM(benchmark::State& state)
+	{
+		size_t banks = static_cast<size_t>(state.range(0));
+		std::string path = gb_bench::writeROM("gb_bench_load_" + std::to_string(banks) + ".gb",
+			gb_bench::blankROM(banks, 0x01));
+		auto mmu = std::make_unique<gb_emu::MMU>();
+		for(auto _ : state) {
+			mmu->loadFromFile(path);
+			benchmark::DoNotOptimize(mmu->isLoaded());
+		}
+		state.SetBytesProcessed(state.iterations() * banks * gb_emu::ROM_BLOCK_SIZE);
+	}
+}
+
+BENCHMARK_CAPTURE(getByte, rom0, gb_emu::FIXED_ROM_BANK + 0x200);
+BENCHMARK_CAPTURE(getByte, romx, gb_emu::SWITCHABLE_ROM_BANK);
+BENCHMARK_CAPTURE(getByte, vram, gb_emu::VRAM_BANK);
+BENCHMARK_CAPTURE(getByte, eram, gb_emu::EXTERNAL_RAM_BANK);
+BENCHMARK_CAPTURE(getByte, wram, gb_emu::WORKING_RAM_BANK);
+BENCHMARK_CAPTURE(getByte, echo, gb_emu::ECHO_RAM_BANK);
+BENCHMARK_CAPTURE(getByte, oam, gb_emu::OAM_TABLE);
+BENCHMARK_CAPTURE(getByte, io, gb_emu::IO_REGISTERS);
+// HRAM is only 127 bytes, so the hram cases start on the last I/O register
+BENCHMARK_CAPTURE(getByte, hram, gb_emu::HRAM - 1);
+
+BENCHMARK_CAPTURE(setByte, vram_tiles, gb_emu::VRAM_BANK);
+BENCHMARK_CAPTURE(setByte, vram_map, gb_emu::TILE_MAP_0);
+BENCHMARK_CAPTURE(setByte, eram, gb_emu::EXTERNAL_RAM_BANK);
+BENCHMARK_CAPTURE(setByte, wram, gb_emu::WORKING_RAM_BANK);
+BENCHMARK_CAPTURE(setByte, echo, gb_emu::ECHO_RAM_BANK);
+BENCHMARK_CAPTURE(setByte, oam, gb_emu::OAM_TABLE);
+BENCHMARK_CAPTURE(setByte, hram, gb_emu::HRAM - 1);
+
+BENCHMARK(mbc1BankSwitch);
+BENCHMARK(loadROM)->Arg(2)->Arg(64);
@@ -0,0 +1,57 @@
+#include "../include/resampler.hpp"
+#include <benchmark/benchmark.h>
+#include <cmath>
+#include <vector>
+
+namespace
+{
+	constexpr uint32_t APU_RATE = 65536;
+	constexpr size_t BLOCK_FRAMES = 1024;
+
+	/**
+	 * A second of a stereo square wave at the APU's rate, which is about as
+	 * hard on the filter as real output gets
+	 */
+	std::vector<int16_t> makeInput()
+	{
+		std::vector<int16_t> input(APU_RATE * 2);
+		for(size_t i = 0; i < APU_RATE; ++i) {
+			input[i * 2] = (i / 75) % 2 ? 8000 : -8000;
+			input[i * 2 + 1] = (i / 50) % 2 ? 8000 : -8000;
+		}
+		return input;
+	}
+
+	/**
+	 * Resamples to outputRate in audio callback sized blocks. Reports output
+	 * frames per second
+	 */
+	void resample(benchmark::State& state, uint32_t outputRate, bool simd)
+	{
+		static const std::vector<int16_t> input = makeInput();
+		gb_emu::Resampler resampler(APU_RATE, outputRate, simd);
+		if(resampler.usingSimd() != simd) {
+			state.SkipWithError("SSE2 path not compiled in");
+			return;
+		}
+		std::vector<int16_t> output(BLOCK_FRAMES * 2);
+		size_t position = 0;
+		for(auto _ : state) {
+			size_t needed = resampler.inputFramesNeeded(BLOCK_FRAMES);
+			while(needed > 0) {
+				size_t frames = std::min(needed, APU_RATE - position);
+				resampler.write(&input[position * 2], frames);
+				position = (position + frames) % APU_RATE;
+				needed -= frames;
+			}
+			benchmark::DoNotOptimize(resampler.read(output.data(), BLOCK_FRAMES));
+			benchmark::ClobberMemory();
+		}
+		state.SetItemsProcessed(state.iterations() * BLOCK_FRAMES);
+	}
+}
+
+BENCHMARK_CAPTURE(resample, scalar_48000, 48000, false);
+BENCHMARK_CAPTURE(resample, sse2_48000, 48000, true);
+BENCHMARK_CAPTURE(resample, scalar_44100, 44100, false);
+BENCHMARK_CAPTURE(resample, sse2_44100, 44100, true);
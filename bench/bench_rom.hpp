@@ -0,0 +1,59 @@
+#pragma once
+
+#include "../include/reservedAddresses.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <iterator>
+#include <string>
+#include <vector>
+
+namespace gb_bench
+{
+	/**
+	 * A blank cartridge of banks 16 KB banks, with the cartridge type set
+	 * and execution starting at 0x150, just past the header
+	 */
+	inline std::vector<uint8_t> blankROM(size_t banks, uint8_t cartridgeType = 0)
+	{
+		std::vector<uint8_t> rom(banks * gb_emu::ROM_BLOCK_SIZE, 0x00);
+		const uint8_t jump[] = { 0xC3, 0x50, 0x01 };
+		std::copy(std::begin(jump), std::end(jump), rom.begin());
+		std::copy(std::begin(jump), std::end(jump), rom.begin() + 0x100);
+		rom[gb_emu::CARTRIDGE_TYPE_FLAG] = cartridgeType;
+		return rom;
+	}
+
+	/**
+	 * A cartridge which runs setup, then pattern over and over to the end
+	 * of the fixed bank, then jumps back to the first pattern
+	 */
+	inline std::vector<uint8_t> loopROM(const std::vector<uint8_t>& setup, const std::vector<uint8_t>& pattern)
+	{
+		std::vector<uint8_t> rom = blankROM(2);
+		size_t pos = 0x150;
+		for(uint8_t byte : setup) rom[pos++] = byte;
+		uint16_t loop = static_cast<uint16_t>(pos);
+		while(pos + pattern.size() + 3 <= gb_emu::ROM_BLOCK_SIZE)
+			for(uint8_t byte : pattern) rom[pos++] = byte;
+		rom[pos++] = 0xC3;
+		rom[pos++] = loop & 0xFF;
+		rom[pos++] = loop >> 8;
+		return rom;
+	}
+
+	/**
+	 * Writes rom to the temp directory as name, and returns its path
+	 */
+	inline std::string writeROM(const std::string& name, const std::vector<uint8_t>& rom)
+	{
+		std::string path = (std::filesystem::temp_directory_path() / name).string();
+		std::FILE* fp = std::fopen(path.c_str(), "wb");
+		if(fp) {
+			std::fwrite(rom.data(), 1, rom.size(), fp);
+			std::fclose(fp);
+		}
+		return path;
+	}
+}
@@ -0,0 +1,270 @@
+#pragma once
+
+#include "common.hpp"
+#include "iodevice.hpp"
+#include "reservedAddresses.hpp"
+#include "ringbuffer.hpp"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace gb_emu
+{
+	/**
+	 * Band-limited synthesis buffer. Rather than sampling a waveform every
+	 * cycle, the channels add a delta whenever their output level changes,
+	 * and each delta is spread over a few samples with a windowed sinc step
+	 * (BLEP). Integrating the deltas then gives alias-free samples at the
+	 * output rate.
+	 *
+	 * Everything after the kernel is built is fixed point, so output is
+	 * repeatable from run to run
+	 */
+	class BlipBuffer
+	{
+	public:
+		static constexpr uint32_t CLOCKS_PER_SAMPLE = 64;
+		static constexpr int KERNEL_TAPS = 16;
+		static constexpr int PHASES = 32;
+		static constexpr int KERNEL_BITS = 15;
+
+		explicit BlipBuffer(size_t maxSamples);
+
+		/**
+		 * Adds a change in output level at an absolute cycle time. time must not
+		 * be more than maxSamples ahead of the last endBlock. Times before it
+		 * are moved up to the first sample still buffered
+		 */
+		void addDelta(uint64_t time, int32_t delta);
+
+		/**
+		 * Marks all samples before the absolute cycle time as complete
+		 */
+		void endBlock(uint64_t time);
+
+		inline size_t samplesAvailable() const { return available; }
+		inline size_t getCapacity() const { return deltas.capacity(); }
+
+		/**
+		 * Discards everything buffered, and restarts output at the absolute
+		 * cycle time
+		 */
+		void reset(uint64_t time);
+
+		/**
+		 * Integrates up to count completed samples into out (every stride'th
+		 * element) and removes them from the buffer. Returns how many were read
+		 */
+		size_t readSamples(int16_t* out, size_t count, size_t stride);
+
+	private:
+		// kernel[phase][tap] for a step at phase / PHASES of the way through a sample
+		static int32_t kernel[PHASES][KERNEL_TAPS];
+		static void buildKernel();
+
+		std::vector<int32_t> deltas;
+		// Absolute sample number of deltas[0]
+		uint64_t firstSample = 0;
+		size_t available = 0;
+		int32_t integrator = 0;
+		// High pass (DC blocking) state, with 16 extra bits of precision
+		int64_t dcLevel = 0;
+	};
+
+	/**
+	 * State shared by all four sound channels
+	 */
+	struct SoundChannel {
+		bool enabled = false; // Reported in NR52
+		bool dacEnabled = false;
+		bool lengthEnabled = false;
+		uint16_t lengthCounter = 0;
+
+		uint8_t volume = 0;
+		uint8_t envelopePeriod = 0;
+		uint8_t envelopeTimer = 0;
+		bool envelopeIncrease = false;
+
+		uint16_t frequency = 0;
+		uint32_t period = 0; // Cycles between waveform steps
+		uint64_t nextStep = 0; // Absolute cycle of the next waveform step
+		uint8_t position = 0; // Duty step or wave sample
+		uint8_t level = 0; // Current output, 0-15
+
+		// Last levels sent to each side, after panning and master volume
+		int32_t left = 0;
+		int32_t right = 0;
+	};
+
+	/**
+	 * The four DMG sound channels. Synthesis happens in blocks: the channels
+	 * are run from one register change (or block end) to the next, only
+	 * doing work at their own waveform steps, and the results go through a
+	 * BlipBuffer per side. Completed stereo samples at SAMPLE_RATE are
+	 * written, interleaved, to a lock-free ring buffer for the audio
+	 * callback or a file sink to drain.
+	 *
+	 * The APU isn't ticked with the CPU. It remembers the cycle it was last
+	 * brought up to date, and only catches up to the CPU's clock when a
+	 * sound register is accessed or sync() is called for more output. With
+	 * output disabled, catching up only runs the frame sequencer so that
+	 * lengths, envelopes and NR52 stay correct
+	 */
+	class APU : public IODevice
+	{
+	public:
+		static constexpr uint32_t SAMPLE_RATE = CLOCK_SPEED / BlipBuffer::CLOCKS_PER_SAMPLE;
+
+		/**
+		 * Everything needed to carry on synthesizing from a save-state.
+		 * Buffered output isn't included
+		 */
+		struct State {
+			uint8_t registers[SOUND_REGISTERS_END - SOUND_REGISTERS + 1];
+			bool power;
+			SoundChannel channels[4];
+			uint8_t sweepTimer;
+			bool sweepEnabled;
+			uint16_t sweepShadow;
+			uint16_t lfsr;
+			uint8_t sequencerStep;
+			uint64_t nextSequencerTime;
+			uint64_t lastUpdate;
+		};
+
+		/**
+		 * clock is the CPU's cycle counter
+		 */
+		explicit APU(const uint64_t& clock);
+
+		/**
+		 * Catches up to the CPU's clock if anything is consuming the output
+		 * and the output ring is running low
+		 */
+		void sync();
+
+		/**
+		 * Catches up to the CPU's clock unconditionally, for consumers which
+		 * take every frame's output as it is produced
+		 */
+		inline void update() { catchUp(); }
+
+		/**
+		 * Whether samples are synthesized at all. Off by default, for
+		 * headless runs with nothing to drain the output
+		 */
+		void setOutputEnabled(bool enabled);
+		inline bool isOutputEnabled() const { return outputEnabled; }
+
+		/**
+		 * Catches up to the CPU's clock first, so the state is current
+		 */
+		void saveState(State& state);
+		/**
+		 * The CPU's clock must already be restored
+		 */
+		void loadState(const State& state);
+
+		uint8_t readIO(uint16_t addr) override;
+		void writeIO(uint16_t addr, uint8_t value) override;
+
+		/**
+		 * Interleaved left/right samples at SAMPLE_RATE
+		 */
+		RingBuffer<int16_t>& getOutput();
+
+		/**
+		 * Bytes of heap in use, which grows once output is wanted
+		 */
+		size_t getHeapSize() const;
+
+		/**
+		 * Samples lost because the output ring was full
+		 */
+		inline uint64_t getDroppedSamples() const { return droppedSamples; }
+
+	private:
+		// The longest run between sample flushes, which bounds the BlipBuffer size
+		static constexpr uint32_t MAX_BLOCK_CYCLES = 32768;
+		static constexpr uint32_t SEQUENCER_PERIOD = CLOCK_SPEED / 512;
+
+		uint8_t registers[SOUND_REGISTERS_END - SOUND_REGISTERS + 1] = {};
+		bool power = false;
+
+		SoundChannel channels[4];
+		// Channel 1 frequency sweep
+		uint8_t sweepTimer = 0;
+		bool sweepEnabled = false;
+		uint16_t sweepShadow = 0;
+		// Channel 4 shift register
+		uint16_t lfsr = 0x7FFF;
+
+		uint8_t sequencerStep = 0;
+		uint64_t nextSequencerTime = SEQUENCER_PERIOD;
+
+		const uint64_t& clock;
+		// The cycle the APU was last brought up to date
+		uint64_t lastUpdate = 0;
+		bool outputEnabled = false;
+
+		BlipBuffer leftBuffer;
+		BlipBuffer rightBuffer;
+		// Only allocated once something wants the samples, as it is most
+		// of the APU's memory
+		std::unique_ptr<RingBuffer<int16_t>> output;
+		std::vector<int16_t> mixBuffer;
+		uint64_t droppedSamples = 0;
+
+		inline uint8_t& reg(uint16_t addr) { return registers[addr - SOUND_REGISTERS]; }
+
+		/**
+		 * Synthesizes up to the absolute cycle time, and passes completed
+		 * samples to the output
+		 */
+		void run(uint64_t until);
+		/**
+		 * Only runs the frame sequencer up to the absolute cycle time, for
+		 * when output is disabled
+		 */
+		void runSequencer(uint64_t until);
+		inline void catchUp() { outputEnabled ? run(clock) : runSequencer(clock); }
+		void runSquare(uint8_t index, uint64_t end);
+		void runWave(uint64_t end);
+		void runNoise(uint64_t end);
+		void flushSamples();
+		/**
+		 * Starts output afresh from lastUpdate, when nothing synthesized
+		 * before then can be carried on from
+		 */
+		void restartOutput();
+		/**
+		 * Moves every channel's next waveform step up to lastUpdate, so a
+		 * state from a VM with output off can be synthesized from
+		 */
+		void rebaseChannels();
+
+		/**
+		 * Sets a channel's level (0-15) from time onwards, applying panning and
+		 * master volume
+		 */
+		void setLevel(uint8_t index, uint64_t time, uint8_t level);
+		/**
+		 * Re-applies panning and master volume to every channel's level
+		 */
+		void remix(uint64_t time);
+
+		/**
+		 * Frame sequencer events, at the absolute cycle time they happen
+		 */
+		void clockSequencer(uint64_t time);
+		void clockLength(uint8_t index, uint64_t time);
+		void clockEnvelope(uint8_t index);
+		void clockSweep(uint64_t time);
+		uint16_t sweepCalculation(uint64_t time);
+
+		void trigger(uint8_t index);
+		void disable(uint8_t index, uint64_t time);
+		void updatePeriod(uint8_t index);
+		void powerOff();
+	};
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "common.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace gb_emu
+{
+	/**
+	 * One emulator run: a cartridge, optionally driven by an input movie,
+	 * for a number of frames
+	 */
+	struct BatchJob {
+		std::string romPath;
+		// Empty for no input
+		std::string moviePath;
+		// 0 with a movie means the movie's length
+		uint64_t frames = 0;
+	};
+
+	struct BatchResult {
+		bool ok = false;
+		uint64_t frames = 0;
+		// Hash of the last frame, to compare runs against each other
+		uint64_t frameHash = 0;
+		std::string error;
+	};
+
+	struct BatchReport {
+		std::vector<BatchResult> results;
+		uint64_t totalFrames = 0;
+		double seconds = 0;
+		size_t threads = 0;
+		uint64_t steals = 0;
+		// The largest VM::getFootprint().total() of any job, at its end
+		size_t peakFootprint = 0;
+		// The largest VM::getFootprint().caches, which the budget leaves out
+		size_t peakCaches = 0;
+		bool hugePages = false;
+
+		inline double framesPerSecond() const { return seconds > 0 ? totalFrames / seconds : 0; }
+	};
+
+	/**
+	 * Reads a job list, one job per line, fields separated by tabs:
+	 *
+	 *   frames <tab> rom path [<tab> movie path]
+	 *
+	 * Blank lines and lines starting with # are skipped. Returns false,
+	 * printing the offending line, if the file can't be read or parsed
+	 */
+	bool readJobList(const std::string& path, std::vector<BatchJob>& jobs);
+
+	/**
+	 * Runs many independent VMs across a work-stealing pool. Each job is
+	 * advanced sliceFrames at a time, then requeued, so long jobs don't
+	 * leave other cores idle at the end and a core that finishes its own
+	 * jobs takes over queued slices from the others. The VMs are allocated
+	 * from a VMPool
+	 */
+	class BatchRunner
+	{
+	public:
+		/**
+		 * 0 threads means one per hardware thread
+		 */
+		explicit BatchRunner(size_t threads = 0, uint32_t sliceFrames = 60, bool hugePages = false);
+
+		BatchReport run(const std::vector<BatchJob>& jobs);
+
+	private:
+		size_t threads;
+		uint32_t sliceFrames;
+		bool hugePages;
+	};
+}
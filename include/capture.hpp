@@ -0,0 +1,162 @@
+#pragma once
+
+#include "common.hpp"
+#include "ringbuffer.hpp"
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace gb_emu
+{
+	enum class CaptureFormat {
+		Y4M, // YUV4MPEG2 stream, 4:4:4 so no chroma is lost
+		RAW_RGB, // Headerless RGB24 frames, back to back
+		PNG_SEQUENCE, // One PNG per frame, named <path>_000000.png onwards
+	};
+
+	/**
+	 * Records completed frames on a worker thread. The emulation thread only
+	 * copies the frame into a free slot and hands it over; it never waits
+	 * for the writer. If the writer falls behind and no slot is free, the
+	 * frame is dropped and counted instead
+	 */
+	class FrameCapture
+	{
+	public:
+		using Frame = std::array<uint32_t, SCREEN_WIDTH * SCREEN_HEIGHT>;
+
+		FrameCapture(const std::string& path, CaptureFormat format, size_t queueFrames = 32);
+		~FrameCapture();
+		FrameCapture(const FrameCapture&) = delete;
+		FrameCapture& operator=(const FrameCapture&) = delete;
+
+		inline bool isOpen() const { return open; }
+
+		/**
+		 * Queues a copy of an ARGB8888 frame for writing
+		 */
+		void submit(const uint32_t* frame);
+
+		/**
+		 * Queues the previously submitted frame again, without copying it.
+		 * For frames which are unchanged from the last one. frame is that
+		 * same frame, which is submitted in full if the last one was dropped
+		 */
+		void submitRepeat(const uint32_t* frame);
+
+		inline uint64_t getDroppedFrames() const { return droppedFrames.load(std::memory_order_relaxed); }
+		inline uint64_t getWrittenFrames() const { return writtenFrames.load(std::memory_order_relaxed); }
+
+	private:
+		// Slot number meaning "write the last frame again"
+		static constexpr uint16_t REPEAT_SLOT = 0xFFFF;
+
+		std::string path;
+		CaptureFormat format;
+		bool open = false;
+		std::FILE* out = nullptr;
+		std::vector<char> outBuffer;
+
+		std::vector<Frame> slots;
+		// Slots move emulator -> writer through ready, and back through free
+		RingBuffer<uint16_t> freeSlots;
+		RingBuffer<uint16_t> readySlots;
+
+		std::atomic<uint64_t> droppedFrames{ 0 };
+		std::atomic<uint64_t> writtenFrames{ 0 };
+		// Emulation thread only. A repeat would write the frame before it
+		bool lastDropped = false;
+
+		std::thread worker;
+		std::mutex wakeMutex;
+		std::condition_variable wake;
+		std::atomic<bool> stopping{ false };
+
+		// Writer thread only. The last frame's encoded bytes, reused for repeats
+		std::vector<uint8_t> encoded;
+		bool haveEncoded = false;
+
+		void hand(uint16_t slot);
+		void run();
+		/**
+		 * Both return false if nothing was written
+		 */
+		bool writeFrame(const Frame& frame);
+		bool writeEncoded();
+	};
+
+	enum class AudioFormat {
+		WAV, // 16 bit stereo PCM WAV
+		RAW_PCM, // Headerless interleaved 16 bit stereo, native endian
+	};
+
+	/**
+	 * Streams the APU's output to a file on a worker thread, so headless
+	 * runs can record audio without an audio device. The worker is the
+	 * consumer of the APU's ring buffer; the emulation thread only has to
+	 * keep the APU caught up.
+	 *
+	 * A checksum of every sample written is kept, hashed in fixed size
+	 * chunks so the result doesn't depend on how the worker's reads happened
+	 * to line up
+	 */
+	class AudioCapture
+	{
+	public:
+		AudioCapture(const std::string& path, AudioFormat format, RingBuffer<int16_t>& input, uint32_t sampleRate);
+		~AudioCapture();
+		AudioCapture(const AudioCapture&) = delete;
+		AudioCapture& operator=(const AudioCapture&) = delete;
+
+		inline bool isOpen() const { return open; }
+
+		/**
+		 * Blocks until the ring is no more than half full. Call before
+		 * catching the APU up, so a run going faster than the writer waits
+		 * rather than losing samples
+		 */
+		void throttle();
+
+		/**
+		 * Writes everything left in the ring, finishes the file and stops the
+		 * worker. Called by the destructor if not before
+		 */
+		void close();
+
+		/**
+		 * Only final once close has been called
+		 */
+		inline uint64_t getChecksum() const { return checksum; }
+		inline uint64_t getWrittenSamples() const { return writtenSamples.load(std::memory_order_relaxed); }
+
+	private:
+		// Samples per checksum chunk
+		static constexpr size_t CHECKSUM_CHUNK = 4096;
+
+		AudioFormat format;
+		RingBuffer<int16_t>& input;
+		bool open = false;
+		std::FILE* out = nullptr;
+		std::vector<char> outBuffer;
+
+		std::atomic<uint64_t> writtenSamples{ 0 };
+
+		std::thread worker;
+		std::atomic<bool> stopping{ false };
+
+		// Writer thread only, until close
+		std::vector<int16_t> block;
+		std::vector<int16_t> pending;
+		uint64_t checksum = 0;
+
+		void run();
+		void write(const int16_t* samples, size_t count);
+		void finishFile();
+	};
+}
@@ -1,10 +1,18 @@
 #pragma once
 
 #include <type_traits>
+#include <cstddef>
 #include <cstdint>
 
 namespace gb_emu
 {
+	// Visible screen dimensions in pixels
+	constexpr size_t SCREEN_WIDTH = 160;
+	constexpr size_t SCREEN_HEIGHT = 144;
+
+	// Machine cycles per second
+	constexpr uint32_t CLOCK_SPEED = 4194304;
+
 	/**
 	 * Converts enum to underlying type
 	 */
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace gb_emu
+{
+	/**
+	 * 64 bit non-cryptographic hash (the XXH64 algorithm). Works on four
+	 * independent 64 bit lanes, so it runs at memory speed on large
+	 * buffers such as whole frames
+	 */
+	uint64_t hashBytes(const void* data, size_t length, uint64_t seed = 0);
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstdint>
+
+namespace gb_emu
+{
+	/**
+	 * A hardware unit which owns some of the I/O registers (0xFF00-0xFF7F).
+	 * The MMU passes reads and writes of those registers to the device
+	 * instead of memory
+	 */
+	class IODevice
+	{
+	public:
+		virtual uint8_t readIO(uint16_t addr) = 0;
+		virtual void writeIO(uint16_t addr, uint8_t value) = 0;
+		virtual ~IODevice() {}
+	};
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "iodevice.hpp"
+#include <cstdint>
+
+namespace gb_emu
+{
+	class MMU;
+
+	/**
+	 * Bits of a joypad state byte. Set means pressed. Directions are the
+	 * low nibble and buttons the high, matching the order P1 reports them in
+	 */
+	enum class Button : uint8_t {
+		RIGHT = 0x01,
+		LEFT = 0x02,
+		UP = 0x04,
+		DOWN = 0x08,
+		A = 0x10,
+		B = 0x20,
+		SELECT = 0x40,
+		START = 0x80,
+	};
+
+	/**
+	 * The P1 register (0xFF00). The game selects the directions and/or the
+	 * buttons with bits 4 and 5, and reads the selected group back in the
+	 * low nibble, with 0 meaning pressed
+	 */
+	class Joypad : public IODevice
+	{
+	public:
+		struct State {
+			uint8_t pressed;
+			uint8_t select;
+		};
+
+		explicit Joypad(MMU& mem);
+
+		void saveState(State& state) const;
+		void loadState(const State& state);
+
+		/**
+		 * Sets which buttons are held, as a mask of Button bits. Requests the
+		 * joypad interrupt if a selected line goes from released to pressed
+		 */
+		void setState(uint8_t pressed);
+		inline uint8_t getState() const { return pressed; }
+
+		uint8_t readIO(uint16_t addr) override;
+		void writeIO(uint16_t addr, uint8_t value) override;
+
+	private:
+		MMU& mem;
+		uint8_t pressed = 0;
+		// Bits 4 and 5 as last written. 0 selects that group
+		uint8_t select = 0x30;
+
+		/**
+		 * The low nibble P1 reads as for a given state, 1 for released
+		 */
+		uint8_t lines(uint8_t state) const;
+	};
+}
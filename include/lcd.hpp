@@ -1,21 +1,37 @@
 #pragma once
 
+#include "common.hpp"
 #include <cstdint>
 #include <SDL.h>
 
 namespace gb_emu
 {
+	/**
+	 * Presents completed frames to an SDL window. The whole frame is
+	 * uploaded once into a streaming texture, and scaled to the window
+	 * with a single copy, so no per-pixel SDL calls are made
+	 */
 	class LCD
 	{
 	public:
-		LCD();
+		/**
+		 * renderDriver selects the SDL render backend by name (e.g. "software",
+		 * "opengl", "direct3d"), or SDL's default if null. scale is the
+		 * initial window size as a multiple of the GB screen
+		 */
+		LCD(const char* renderDriver = nullptr, int scale = 4);
 		~LCD();
-		void setColour(uint32_t r, uint32_t g, uint32_t b);
-		inline void hblank() { currX = 0; ++currY; }
-		inline void vblank() { currX = currY = 0; }
+		LCD(const LCD&) = delete;
+		LCD& operator=(const LCD&) = delete;
+
+		/**
+		 * Uploads a SCREEN_WIDTH * SCREEN_HEIGHT ARGB8888 frame to the
+		 * texture and presents it
+		 */
+		void present(const uint32_t* frame);
 	private:
-		SDL_Window * window;
-		SDL_Renderer* renderer;
-		uint8_t currX = 0, currY = 0;
+		SDL_Window * window = nullptr;
+		SDL_Renderer* renderer = nullptr;
+		SDL_Texture* texture = nullptr;
 	};
-}
\ No newline at end of file
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "common.hpp"
+#include "ringbuffer.hpp"
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace gb_emu
+{
+	class VM;
+	class Serial;
+	enum class ExecuteResult;
+
+	/**
+	 * Connects the serial ports of two VMs in the same process, so each can
+	 * run on its own thread.
+	 *
+	 * The two sides don't run in lockstep. Each publishes how far its clock
+	 * has got, and may run up to TRANSFER_CYCLES past the other's. A byte
+	 * sent when a transfer starts takes effect on the other side a full
+	 * transfer later, so it always arrives in time. The sides only stop to
+	 * look at each other at those window edges, and wait only when one has
+	 * got that far ahead or a transfer is due to finish and its reply hasn't
+	 * arrived. Everything goes through a lock-free ring buffer in each
+	 * direction and two atomic clocks. Transfers land on the same
+	 * instruction however the threads are scheduled, so linked runs are
+	 * deterministic.
+	 *
+	 * Only one side should clock a transfer. If both sides start internally
+	 * clocked transfers less than a transfer apart, neither is listening to
+	 * the other: both finish as they would with nothing connected, reading
+	 * 0xFF, and neither side's SB is sent
+	 */
+	class LinkCable
+	{
+	public:
+		/**
+		 * Connects a and b, which must be between frames and outlive the cable
+		 */
+		LinkCable(VM& a, VM& b);
+		/**
+		 * Disconnects both VMs. Neither may be running
+		 */
+		~LinkCable();
+		LinkCable(const LinkCable&) = delete;
+		LinkCable& operator=(const LinkCable&) = delete;
+
+		/**
+		 * Runs both VMs for frames frames, each on its own thread. Returns
+		 * the first error either hit
+		 */
+		ExecuteResult run(uint64_t frames);
+
+		/**
+		 * For running the VMs some other way: called from vm's thread once it
+		 * will run no further, so the other side stops waiting for it. Later
+		 * transfers on the other side see nothing connected
+		 */
+		void leave(VM& vm);
+
+	private:
+		friend class Serial;
+
+		struct Message {
+			// Link time at which it takes effect on the receiving side
+			uint64_t time;
+			uint8_t byte;
+			// The reply to a transfer the receiver started, rather than a new one
+			bool reply;
+		};
+
+		static constexpr uint64_t GONE = ~0ULL;
+
+		struct alignas(64) End {
+			// Link time this side has reached, published at each sync. GONE once it has left
+			std::atomic<uint64_t> clock{ 0 };
+			// Written by the other side only
+			RingBuffer<Message> inbox{ 16 };
+
+			// The rest is only touched from this side's thread
+			Serial* serial = nullptr;
+			// The VM's clock when connected, so link time starts at 0 on both sides
+			uint64_t base = 0;
+			// Received messages not yet due, in time order
+			std::vector<Message> pending;
+			// Link time this side may run up to before syncing
+			uint64_t horizon = 0;
+			// Whether the reply to this side's transfer has been received
+			bool replied = false;
+			// Link time this side last started clocking a transfer, GONE if never
+			uint64_t started = GONE;
+		};
+
+		VM* vms[2];
+		End ends[2];
+
+		uint64_t now(int side) const;
+		void send(int side, const Message& message);
+		void receive(int side);
+		void apply(int side, const Message& message);
+
+		/**
+		 * A transfer has been started by side's program
+		 */
+		void start(int side);
+		/**
+		 * Handles whatever is due on side, waiting on the other side if it
+		 * has to
+		 */
+		void sync(int side);
+		/**
+		 * Sets when side's serial next needs to sync
+		 */
+		void schedule(int side);
+		void leave(int side);
+	};
+}
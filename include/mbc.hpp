@@ -1,7 +1,6 @@
 #pragma once
 
 #include <cstdint>
-#include <vector>
 /**
  * This file contains the memory bank controllers which intercept
  * attempts to write to certain areas of memory and perform bank
@@ -11,12 +10,35 @@
 namespace gb_emu
 {
 	/**
-	 * This is the base MBC
+	 * Bank registers, for save-states. The ROM itself isn't saved, only
+	 * which bank is mapped
+	 */
+	struct MBCState {
+		uint16_t romBank;
+		bool ROMBanking;
+	};
+
+	/**
+	 * This is the base MBC. It only tracks the bank registers; the MMU maps
+	 * the selected bank of the cartridge into the address space
 	 */
 	class MBC
 	{
 	public:
-		virtual void captureWrite(uint16_t addr, uint8_t byte, const std::vector<uint8_t>& cartridgeROM, uint8_t* memory) = 0;
+		virtual void captureWrite(uint16_t addr, uint8_t byte) = 0;
+		/**
+		 * The ROM bank mapped at SWITCHABLE_ROM_BANK
+		 */
+		virtual uint16_t getROMBank() const { return 1; }
+		/**
+		 * A new MBC in the same state, for forked VMs
+		 */
+		virtual MBC* clone() const = 0;
+		virtual void saveState(MBCState& state) const { state = { 1, true }; }
+		/**
+		 * Restores the bank registers
+		 */
+		virtual void loadState(const MBCState&) {}
 		virtual ~MBC() {}
 	};
 
@@ -26,16 +48,22 @@ namespace gb_emu
 	class MBC_Null : public MBC
 	{
 	public:
-		virtual void captureWrite(uint16_t addr, uint8_t byte, const std::vector<uint8_t>& cartridgeROM, uint8_t* memory) override;
+		virtual void captureWrite(uint16_t addr, uint8_t byte) override;
+		virtual MBC* clone() const override { return new MBC_Null(*this); }
 		~MBC_Null() = default;
 	};
 
 	class MBC1 : public MBC
 	{
 	public:
-		virtual void captureWrite(uint16_t addr, uint8_t byte, const std::vector<uint8_t>& cartridgeROM, uint8_t* memory) override;
+		virtual void captureWrite(uint16_t addr, uint8_t byte) override;
+		virtual MBC* clone() const override { return new MBC1(*this); }
+		virtual uint16_t getROMBank() const override { return romBank; }
+		virtual void saveState(MBCState& state) const override;
+		virtual void loadState(const MBCState& state) override;
 		~MBC1() = default;
 	private:
 		bool ROMBanking = true;
+		uint16_t romBank = 1;
 	};
 }
\ No newline at end of file
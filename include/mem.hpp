@@ -1,49 +1,269 @@
 #pragma once
 
 #include "common.hpp"
+#include "mbc.hpp"
 #include "reservedAddresses.hpp"
+#include "oam.hpp"
+#include "tilecache.hpp"
+#include <algorithm>
 #include <cstdint>
+#include <iterator>
+#include <memory>
 #include <string>
 #include <vector>
 
 namespace gb_emu
 {
-	class MBC;
+	class IODevice;
 
+	/**
+	 * A frozen copy of the writable address space (VRAM up), which forked
+	 * MMUs read from until they write
+	 */
+	struct SharedMemory {
+		uint8_t memory[MEM_SIZE - VRAM_BANK];
+	};
+
+	/**
+	 * The address space. Reads go through a table of 256 byte pages.
+	 *
+	 * ROM pages point straight into the cartridge, which is loaded once and
+	 * shared by every fork, so only VRAM and up is held per instance. Each
+	 * of those pages is either in this MMU's own memory or in a SharedMemory
+	 * image shared with other MMUs forked from the same point, and is copied
+	 * into memory the first time it is written (copy on write).
+	 *
+	 * OAM and the I/O registers (0xFE00 up) are always owned, so hardware
+	 * units can touch them directly
+	 */
 	class MMU
 	{
+	public:
+		static constexpr size_t PAGE_SIZE = 0x100;
+		static constexpr size_t PAGE_COUNT = MEM_SIZE / PAGE_SIZE;
+		// Everything from VRAM up, which is all that can be written
+		static constexpr size_t RAM_SIZE = MEM_SIZE - VRAM_BANK;
+		// Pages from VRAM up, which are the ones save-states hold
+		static constexpr size_t STATE_PAGES = RAM_SIZE / PAGE_SIZE;
+		static constexpr size_t FIRST_RAM_PAGE = VRAM_BANK / PAGE_SIZE;
 	private:
-		uint8_t memory[MEM_SIZE];
+		// VRAM_BANK to the end of the address space
+		uint8_t memory[RAM_SIZE];
+		inline uint8_t& ram(uint16_t addr) { return memory[addr - VRAM_BANK]; }
+		inline uint8_t ram(uint16_t addr) const { return memory[addr - VRAM_BANK]; }
+
+		// Where each page is read from: the cartridge for ROM, and for the
+		// rest its place in memory when owned, or base
+		const uint8_t* pages[PAGE_COUNT];
+		// One bit per RAM page which lives in memory and so can be written
+		uint64_t ownedPages[PAGE_COUNT / 64];
+		// RAM pages read from base
+		size_t sharedPageCount = 0;
+		std::shared_ptr<const SharedMemory> base;
 
-		std::vector<uint8_t> cartridgeROM;
+		// Shared between forks, as it never changes. Padded to whole banks
+		std::shared_ptr<const std::vector<uint8_t>> cartridgeROM;
 
 		MBC* mbc = nullptr;
+		// The bank mapROM put in switchable ROM, 0 with no cartridge
+		uint16_t romBank = 0;
+		uint64_t bankSwitches = 0;
+
+		OAMIndex oamIndex;
+		TileMapCache tileMapCache;
+
+		// Devices owning each I/O register, or null where memory is used
+		IODevice* ioDevices[IO_REGISTERS_SIZE] = {};
+
+		// One bit per PAGE_SIZE page, set by every write since markClean
+		uint64_t dirtyPages[PAGE_COUNT / 64] = {};
+		inline void markDirty(uint16_t addr) { dirtyPages[addr >> 14] |= 1ULL << ((addr >> 8) & 63); }
 
 		void clear();
+
+		inline bool isOwned(uint8_t page) const { return (ownedPages[page >> 6] >> (page & 63)) & 1; }
+		/**
+		 * Makes the page containing addr writable, copying it out of base if shared
+		 */
+		inline void own(uint16_t addr) { if(!isOwned(addr >> 8)) copyPage(addr >> 8); }
+		void ownRange(uint16_t addr, size_t size);
+		void copyPage(uint8_t page);
+		/**
+		 * Zeroes memory and points every RAM page at it, sharing nothing
+		 */
+		void resetPages();
+		/**
+		 * Points every RAM page at memory, sharing nothing, without clearing it
+		 */
+		void mapOwnPages();
+		/**
+		 * Points the ROM pages at the fixed bank and the MBC's selected bank
+		 */
+		void mapROM();
+		/**
+		 * Moves every page but OAM and the I/O registers into a shared image,
+		 * reusing the current one if nothing has been written since
+		 */
+		void freeze();
+
+		/**
+		 * Handles writes to OAM, the I/O registers and HRAM, some of which
+		 * have side effects
+		 */
+		void setHighByte(uint16_t addr, uint8_t value);
+
+		/**
+		 * Copies 160 bytes from (source << 8) into OAM
+		 */
+		void doOAMDMA(uint8_t source);
 	public:
+		/**
+		 * Everything from VRAM up, and the bank registers. ROM is left out, as
+		 * the cartridge is the same on both sides of a save-state
+		 */
+		struct State {
+			uint8_t memory[MEM_SIZE - VRAM_BANK];
+			MBCState mbc;
+		};
+
+		/**
+		 * Only the pages of State::memory written since the last markClean.
+		 * Not trivially copyable, as pages varies in size
+		 */
+		struct DeltaState {
+			// Bit n set if page n (counting from VRAM) is in pages
+			uint64_t pageMask[STATE_PAGES / 64];
+			// The included pages, in order, back to back
+			std::vector<uint8_t> pages;
+			MBCState mbc;
+		};
+
+		struct ForkTag {};
+
+		MMU();
+		/**
+		 * Leaves memory uncleared, so it costs nothing until written, for
+		 * forkFrom to map the pages onto the parent's instead
+		 */
+		explicit MMU(ForkTag);
 		~MMU();
+		MMU(const MMU&) = delete;
+		MMU& operator=(const MMU&) = delete;
 		void loadFromFile(std::string path);
-		inline uint8_t getZeroPageByte(uint8_t addr) const { return memory[0xFF00 + addr]; }
-		inline void setZeroPageByte(uint8_t addr, uint8_t value) { memory[0xFF00 + addr] = value; }
+		inline bool isLoaded() const { return mbc != nullptr; }
+
+		/**
+		 * The ROM bank mapped at addr: the selected bank in switchable ROM,
+		 * otherwise 0
+		 */
+		inline uint16_t getBank(uint16_t addr) const
+		{
+			return addr >= SWITCHABLE_ROM_BANK && addr <= SWITCHABLE_ROM_BANK_END ? romBank : 0;
+		}
+		/**
+		 * Writes to the MBC which changed the ROM bank. Not part of
+		 * save-states or forks
+		 */
+		inline uint64_t getBankSwitches() const { return bankSwitches; }
+
+		/**
+		 * Turns this MMU into a copy of parent which shares all its memory
+		 * copy on write. parent's memory is frozen into a shared image too,
+		 * so neither sees the other's later writes. I/O devices aren't copied
+		 */
+		void forkFrom(MMU& parent);
+
+		/**
+		 * Pages of memory this MMU has its own copy of
+		 */
+		inline size_t getOwnedPageCount() const { return STATE_PAGES - sharedPageCount; }
+
+		/**
+		 * Bytes of heap this MMU owns, and bytes it shares with forks
+		 * (the cartridge and any frozen image)
+		 */
+		size_t getHeapSize() const;
+		size_t getSharedSize() const;
+
+		/**
+		 * Routes reads and writes of the I/O registers first to last (inclusive)
+		 * to device. The device is not owned
+		 */
+		void mapIO(uint16_t first, uint16_t last, IODevice* device);
+
+		void saveState(State& state) const;
+		/**
+		 * Copies out the pages written since markClean
+		 */
+		void saveDelta(DeltaState& delta) const;
+		/**
+		 * Brings a full state up to date with a delta taken after it
+		 */
+		static void applyDelta(State& state, const DeltaState& delta);
+
+		/**
+		 * Starts tracking writes afresh, e.g. once a snapshot is taken
+		 */
+		inline void markClean() { std::fill(std::begin(dirtyPages), std::end(dirtyPages), 0); }
+		inline bool isPageDirty(uint8_t page) const { return (dirtyPages[page >> 6] >> (page & 63)) & 1; }
+		/**
+		 * Also rebuilds the sprite index and tile cache from the restored memory
+		 */
+		void loadState(const State& state);
+		inline uint8_t getZeroPageByte(uint8_t addr) const { return getByte(0xFF00 + addr); }
+		inline void setZeroPageByte(uint8_t addr, uint8_t value) { setByte(0xFF00 + addr, value); }
 
 
 		uint8_t getByte(uint16_t addr) const;
 		void setByte(uint16_t addr, uint8_t value);
+		/**
+		 * Reads memory as stored, without asking I/O devices for their
+		 * registers. For looking, not emulating
+		 */
+		inline uint8_t peekByte(uint16_t addr) const { return pages[addr >> 8][addr & 0xFF]; }
 
 		/**
 		* Fetches the next double byte, and increments program counter
 		* twice. Assumes LSB is stored at addr
 		*/
-		inline uint16_t getDouble(uint16_t addr) const { return memory[addr] | (memory[addr + 1] << 8); };
+		inline uint16_t getDouble(uint16_t addr) const {
+			uint16_t next = static_cast<uint16_t>(addr + 1);
+			return pages[addr >> 8][addr & 0xFF] | (pages[next >> 8][next & 0xFF] << 8);
+		};
 
 		/**
 		* Write double to memory, with LSB first
 		*/
 		inline void setDouble(uint16_t addr, uint16_t value) {
-			memory[addr] = static_cast<uint8_t>(value & 0xFF);
-			memory[addr + 1] = static_cast<uint8_t>(value >> 8);
+			setByte(addr, static_cast<uint8_t>(value & 0xFF));
+			setByte(addr + 1, static_cast<uint8_t>(value >> 8));
 		}
 
+		/**
+		 * Direct access to hardware registers, bypassing any write side effects.
+		 * For use by the hardware units which own those registers (e.g. LY)
+		 */
+		inline uint8_t getIORegister(uint16_t addr) const { return ram(addr); }
+		inline void setIORegister(uint16_t addr, uint8_t value) { ram(addr) = value; markDirty(addr); }
+
+		/**
+		 * Raw read access for hardware units which scan whole regions,
+		 * such as the PPU reading VRAM and OAM. addr must be VRAM or above.
+		 * The size bytes from addr are contiguous, which may mean taking a
+		 * copy of shared pages
+		 */
+		const uint8_t* getRegion(uint16_t addr, size_t size);
+
+		/**
+		 * Sprite selection for each line, kept up to date with OAM writes and DMA
+		 */
+		inline OAMIndex& getOAMIndex() { return oamIndex; }
+
+		/**
+		 * Decoded background layers, kept up to date with VRAM writes
+		 */
+		inline TileMapCache& getTileMapCache() { return tileMapCache; }
+		inline const TileMapCache& getTileMapCache() const { return tileMapCache; }
 
 	};
 }
\ No newline at end of file
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace gb_emu
+{
+	/**
+	 * Input movies hold the joypad state for every frame, stored as the
+	 * frames where it changes. Frame n's state is the one set before the
+	 * VM runs its nth frame (counting from 0).
+	 *
+	 * File layout:
+	 *   "GBMV"      magic
+	 *   u8          format version (1)
+	 *   then records to the end of the file:
+	 *     varint    frames since the previous record (LEB128, 7 bits a byte)
+	 *     u8        joypad state from that frame on, as Button bits
+	 *
+	 * The state before the first record is 0 (nothing held). The last record
+	 * is written when recording stops, and its frame is the movie's length
+	 */
+	namespace movie
+	{
+		constexpr char MAGIC[4] = { 'G', 'B', 'M', 'V' };
+		constexpr uint8_t VERSION = 1;
+	}
+
+	class MovieRecorder
+	{
+	public:
+		explicit MovieRecorder(const std::string& path);
+		~MovieRecorder();
+		MovieRecorder(const MovieRecorder&) = delete;
+		MovieRecorder& operator=(const MovieRecorder&) = delete;
+
+		inline bool isOpen() const { return out != nullptr; }
+
+		/**
+		 * Notes the state for a frame. Only changes are written. Returns
+		 * false, writing nothing, if frame is before the last one recorded
+		 */
+		bool record(uint64_t frame, uint8_t state);
+
+		/**
+		 * Ends the movie at frame, which becomes its length
+		 */
+		void close(uint64_t frame);
+
+	private:
+		std::FILE* out = nullptr;
+		uint64_t lastFrame = 0;
+		uint8_t lastState = 0;
+
+		void writeRecord(uint64_t frame, uint8_t state);
+	};
+
+	class MoviePlayer
+	{
+	public:
+		explicit MoviePlayer(const std::string& path);
+
+		inline bool isOpen() const { return open; }
+
+		/**
+		 * The joypad state for a frame. Fastest when frames are asked for in order
+		 */
+		uint8_t stateFor(uint64_t frame);
+
+		/**
+		 * The first frame after frame with a record, so the state holds from
+		 * frame until then. UINT64_MAX past the end
+		 */
+		uint64_t nextChange(uint64_t frame);
+
+		inline uint64_t getLength() const { return changes.empty() ? 0 : changes.back().frame; }
+		inline bool finished(uint64_t frame) const { return frame >= getLength(); }
+
+	private:
+		struct Change {
+			uint64_t frame;
+			uint8_t state;
+		};
+
+		bool open = false;
+		std::vector<Change> changes;
+		// Index of the first change after the last frame asked for
+		size_t next = 0;
+	};
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "common.hpp"
+#include <cstdint>
+
+/**
+ * This file contains the sprite index, which tracks which of the 40 OAM
+ * sprites fall on each visible line
+ */
+
+namespace gb_emu
+{
+	/**
+	 * Per-line sprite selection, kept up to date as OAM is written so the
+	 * scanline renderer doesn't have to search all 40 entries every line.
+	 * Line membership is updated incrementally when a sprite's Y changes,
+	 * and each line's sorted list is only rebuilt when something on it has
+	 * changed
+	 */
+	class OAMIndex
+	{
+	public:
+		static constexpr size_t SPRITE_COUNT = 40;
+		static constexpr size_t MAX_SPRITES_PER_LINE = 10;
+
+		/**
+		 * The (at most 10) sprites selected for a line, as OAM entry numbers
+		 * in drawing priority order: lowest X first, then lowest entry
+		 */
+		struct LineSprites {
+			uint8_t count = 0;
+			uint8_t sprites[MAX_SPRITES_PER_LINE] = {};
+		};
+
+		OAMIndex();
+
+		/**
+		 * Updates the index after a byte of OAM has been written. offset
+		 * is relative to OAM_TABLE
+		 */
+		void write(uint8_t offset, uint8_t value);
+
+		/**
+		 * Rebuilds the whole index from a full OAM table, e.g. after a DMA
+		 */
+		void rebuild(const uint8_t* oam);
+
+		/**
+		 * Switches between 8x8 and 8x16 sprites (LCDC bit 2)
+		 */
+		void setTallSprites(bool tall);
+
+		/**
+		 * Gets the sorted sprite list for a visible line, rebuilding it first if
+		 * it has changed
+		 */
+		const LineSprites& line(uint8_t ly);
+
+	private:
+		uint8_t spriteY[SPRITE_COUNT] = {};
+		uint8_t spriteX[SPRITE_COUNT] = {};
+		uint8_t spriteHeight = 8;
+
+		// Bit n is set if sprite n overlaps the line. 40 sprites fit in 64 bits
+		uint64_t lineMasks[SCREEN_HEIGHT] = {};
+		bool lineDirty[SCREEN_HEIGHT];
+		LineSprites lines[SCREEN_HEIGHT];
+
+		/**
+		 * Adds or removes the sprite from the masks of every line it covers
+		 */
+		void addSprite(uint8_t sprite);
+		void removeSprite(uint8_t sprite);
+
+		/**
+		 * Marks every line the sprite covers as needing its list re-sorted
+		 */
+		void markDirty(uint8_t sprite);
+
+		/**
+		 * Gets the range of visible lines [first, last) covered by the sprite
+		 */
+		void lineRange(uint8_t sprite, int& first, int& last) const;
+	};
+}
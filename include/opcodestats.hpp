@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * Per-opcode instrumentation for the interpreter, chosen at compile time.
+ * Building with GB_EMU_OPCODE_STATS defined (the CMake option of the same
+ * name) makes VM count every opcode it executes. Without it the VM holds
+ * a NoOpcodeStats, whose methods are empty, so the counting compiles to
+ * nothing
+ */
+
+namespace gb_emu
+{
+	/**
+	 * Executions and cycles of each of the 256 opcodes and 256 CB prefixed
+	 * opcodes, with a histogram of how many cycles each execution took
+	 * (conditional jumps, calls and returns vary)
+	 */
+	class OpcodeStats
+	{
+	public:
+		static constexpr bool ENABLED = true;
+		static constexpr size_t OPCODES = 256;
+		// 4 to 24 cycles in steps of 4, then anything else
+		static constexpr size_t CYCLE_BUCKETS = 7;
+
+		struct Counter {
+			uint64_t executions;
+			uint64_t cycles;
+			uint64_t histogram[CYCLE_BUCKETS];
+		};
+
+		inline void count(uint8_t opcode, uint32_t cycles) { add(counters[opcode], cycles); }
+		/**
+		 * For the byte after 0xCB. The 0xCB itself is counted by count too,
+		 * with the cycles of the whole instruction
+		 */
+		inline void countCB(uint8_t opcode, uint32_t cycles) { add(cbCounters[opcode], cycles); }
+
+		inline const Counter& get(uint8_t opcode) const { return counters[opcode]; }
+		inline const Counter& getCB(uint8_t opcode) const { return cbCounters[opcode]; }
+
+		void reset();
+
+		/**
+		 * Writes every opcode executed, most executed first, labelled with
+		 * its Opcode_Exact or CB_Opcode_Exact name. Returns false if the
+		 * file can't be written
+		 */
+		bool writeReport(const std::string& path) const;
+
+		/**
+		 * The Opcode_Exact name of opcode, or its hex value if it has none
+		 */
+		static std::string getName(uint8_t opcode);
+		/**
+		 * The CB_Opcode_Exact name of opcode, with b replaced by the bit
+		 * number for BIT, RES and SET
+		 */
+		static std::string getCBName(uint8_t opcode);
+
+	private:
+		Counter counters[OPCODES] = {};
+		Counter cbCounters[OPCODES] = {};
+
+		static inline void add(Counter& counter, uint32_t cycles)
+		{
+			++counter.executions;
+			counter.cycles += cycles;
+			size_t bucket = cycles / 4 - 1;
+			++counter.histogram[cycles % 4 == 0 && bucket < CYCLE_BUCKETS - 1 ? bucket : CYCLE_BUCKETS - 1];
+		}
+	};
+
+	/**
+	 * Takes the place of OpcodeStats when it isn't compiled in
+	 */
+	struct NoOpcodeStats {
+		static constexpr bool ENABLED = false;
+
+		inline void count(uint8_t, uint32_t) {}
+		inline void countCB(uint8_t, uint32_t) {}
+		inline void reset() {}
+		inline bool writeReport(const std::string&) const { return false; }
+	};
+
+#ifdef GB_EMU_OPCODE_STATS
+	using OpcodeStatsPolicy = OpcodeStats;
+#else
+	using OpcodeStatsPolicy = NoOpcodeStats;
+#endif
+}
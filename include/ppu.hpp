@@ -0,0 +1,97 @@
+#pragma once
+
+#include "common.hpp"
+#include <array>
+#include <cstdint>
+#include <memory>
+
+namespace gb_emu
+{
+	class MMU;
+
+	/**
+	 * The LCD status register's mode bits
+	 */
+	enum class PPUMode : uint8_t {
+		HBLANK = 0,
+		VBLANK = 1,
+		OAM_SCAN = 2,
+		TRANSFER = 3,
+		MASK = 0x3,
+	};
+
+	/**
+	 * The pixel processing unit. Keeps LY/STAT in step with the CPU and
+	 * renders each visible line into a buffer of shade numbers as the line
+	 * is drawn
+	 */
+	class PPU
+	{
+	public:
+		static constexpr uint32_t CYCLES_PER_LINE = 456;
+		static constexpr uint32_t LINES_PER_FRAME = 154;
+		static constexpr uint32_t CYCLES_PER_FRAME = CYCLES_PER_LINE * LINES_PER_FRAME;
+
+		/**
+		 * Position within the frame, and the framebuffer as shade numbers
+		 * (0 lightest to 3 darkest), so a loaded state shows what was on
+		 * screen when it was saved rather than the frame before loading
+		 */
+		struct State {
+			uint32_t lineCycles;
+			uint8_t ly;
+			uint8_t windowLine;
+			PPUMode mode;
+			bool enabled;
+			uint8_t shades[SCREEN_WIDTH * SCREEN_HEIGHT];
+		};
+
+		explicit PPU(MMU& mem);
+
+		void saveState(State& state) const;
+		void loadState(const State& state);
+
+		/**
+		 * Advances by the given number of cycles. Returns true if a frame
+		 * was completed (i.e. vblank was entered)
+		 */
+		bool step(uint32_t cycles);
+
+		/**
+		 * The frame as shade numbers (0 lightest to 3 darkest), one byte a pixel
+		 */
+		inline const uint8_t* getShades() const { return shades.data(); }
+		/**
+		 * The frame as ARGB8888 pixels. Converted from the shades on the
+		 * first call after they change, so instances which never present
+		 * (headless runs, fresh forks) never allocate it
+		 */
+		const uint32_t* getFramebuffer() const;
+		inline size_t getHeapSize() const { return framebuffer ? SCREEN_WIDTH * SCREEN_HEIGHT * sizeof(uint32_t) : 0; }
+	private:
+		MMU& mem;
+		uint32_t lineCycles = 0;
+		uint8_t ly = 0;
+		// The window keeps its own line count, which only advances on lines it is shown
+		uint8_t windowLine = 0;
+		PPUMode mode = PPUMode::OAM_SCAN;
+		bool enabled = false;
+
+		std::array<uint8_t, SCREEN_WIDTH * SCREEN_HEIGHT> shades = {};
+		mutable std::unique_ptr<uint32_t[]> framebuffer;
+		mutable bool framebufferCurrent = false;
+
+		void setMode(PPUMode m);
+		void setLY(uint8_t line);
+		void requestInterrupt(uint8_t bit);
+
+		void renderScanline();
+		/**
+		 * Fills colourIds with the background/window colour numbers (0-3, before
+		 * the palette is applied) for the current line
+		 */
+		void renderBackground(uint8_t lcdc, uint8_t* colourIds);
+		void renderWindow(uint8_t lcdc, uint8_t* colourIds);
+		void renderSprites(uint8_t lcdc, const uint8_t* colourIds, uint8_t* line);
+	};
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace gb_emu
+{
+	/**
+	 * Samples where a VM's program is every interval emulated cycles, to
+	 * show which ROM routines the emulated time goes on.
+	 *
+	 * A shadow call stack of call sites is kept from CALL, RST, interrupts
+	 * and RET/RETI, so each sample is the chain of routines that led to the
+	 * current PC.
+	 * Frames are matched to returns by SP, so code which drops a return
+	 * address or returns through a pushed address doesn't leave the stack
+	 * out of step for long.
+	 *
+	 * Samples are written as folded stacks, one line per distinct stack
+	 * with its emulated cycles, which flamegraph.pl and speedscope read.
+	 * Addresses are written as bank:address, or with the names from an
+	 * RGBDS .sym file if one is loaded. Time spent halted is its own frame,
+	 * [halted], on top of the routine which halted
+	 */
+	class Profiler
+	{
+	public:
+		// Not a multiple of any of the PPU's periods, so samples don't line up with a game's frame loop
+		static constexpr uint32_t DEFAULT_INTERVAL = 997;
+
+		explicit Profiler(uint32_t interval = DEFAULT_INTERVAL);
+
+		/**
+		 * Reads an RGBDS symbol file: lines of "bank:address name", with ;
+		 * comments. Returns false if it can't be read
+		 */
+		bool loadSymbols(const std::string& path);
+
+		/**
+		 * Writes the folded stacks. Returns false if the file can't be written
+		 */
+		bool writeFolded(const std::string& path) const;
+
+		inline uint32_t getInterval() const { return interval; }
+		inline uint64_t getSampleCount() const { return sampleCount; }
+
+		// Called by the VM
+
+		/**
+		 * site is the address of the CALL or RST, or the instruction an
+		 * interrupt came in before. sp is SP after the return address is pushed
+		 */
+		void onCall(uint16_t bank, uint16_t site, uint16_t sp);
+		/**
+		 * sp is SP with the return address still on the stack
+		 */
+		void onReturn(uint16_t sp);
+		/**
+		 * Counts weight intervals against the current stack and PC
+		 */
+		void sample(uint16_t bank, uint16_t pc, bool halted, uint64_t weight);
+		/**
+		 * Forgets the call stack, e.g. when a state is loaded
+		 */
+		inline void resetStack() { stack.clear(); }
+
+	private:
+		struct Frame {
+			// Where the call was made from, so the routine it names is the caller
+			uint32_t location;
+			// SP just after the return address was pushed
+			uint16_t sp;
+		};
+
+		struct Symbol {
+			uint32_t location;
+			std::string name;
+		};
+
+		// Calls deeper than this are not tracked (but still unwound)
+		static constexpr size_t MAX_DEPTH = 256;
+		// Marks a sample taken while halted
+		static constexpr uint32_t HALTED = ~0U;
+
+		uint32_t interval;
+		uint64_t sampleCount = 0;
+		std::vector<Frame> stack;
+		// Call stack locations then the PC, to emulated cycles
+		std::map<std::vector<uint32_t>, uint64_t> samples;
+		// Reused for lookups, so sampling doesn't allocate once a stack has been seen
+		std::vector<uint32_t> key;
+		// Sorted by location
+		std::vector<Symbol> symbols;
+
+		static inline uint32_t locate(uint16_t bank, uint16_t addr) { return (static_cast<uint32_t>(bank) << 16) | addr; }
+
+		/**
+		 * The name of the routine containing location: the nearest symbol at
+		 * or before it in the same bank and memory region, or bank:address if
+		 * there isn't one
+		 */
+		std::string describe(uint32_t location) const;
+	};
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GB_EMU_SSE2 1
+#endif
+
+namespace gb_emu
+{
+	/**
+	 * Converts interleaved stereo samples from the APU's rate to the host's
+	 * with a polyphase windowed sinc filter, then applies per side volume.
+	 *
+	 * The position between input samples is 32.32 fixed point, and each
+	 * output sample interpolates between the two nearest of PHASES filter
+	 * phases. The step can be nudged a fraction of a percent either way
+	 * with setRateAdjust, which changes pitch too little to hear but lets
+	 * the consumer keep its buffer from draining or overflowing
+	 */
+	class Resampler
+	{
+	public:
+		static constexpr int TAPS = 16;
+		static constexpr int PHASES = 256;
+		// The furthest setRateAdjust will move the rate either way
+		static constexpr double MAX_RATE_ADJUST = 0.005;
+
+		/**
+		 * simd selects the SSE2 path where it is compiled in. The scalar path
+		 * is the reference, and the two agree to within rounding
+		 */
+		Resampler(uint32_t inputRate, uint32_t outputRate, bool simd = true);
+
+		/**
+		 * Adds interleaved stereo input frames. Doesn't allocate while
+		 * within the room reserve made
+		 */
+		void write(const int16_t* in, size_t frames);
+
+		/**
+		 * Writes up to frames interleaved stereo output frames, as many as the
+		 * buffered input allows. Returns how many were written
+		 */
+		size_t read(int16_t* out, size_t frames);
+
+		/**
+		 * Input frames that still have to be written before read can return
+		 * frames output frames
+		 */
+		size_t inputFramesNeeded(size_t frames) const;
+
+		/**
+		 * The most inputFramesNeeded can return for frames output frames, at
+		 * any rate adjustment
+		 */
+		size_t maxInputFrames(size_t frames) const;
+
+		/**
+		 * Makes room for output blocks of up to frames frames, so that writing
+		 * what inputFramesNeeded asks for then reading never allocates. For
+		 * consumers on a real-time thread
+		 */
+		void reserve(size_t frames);
+
+		/**
+		 * Scales the input rate by 1 + adjust, clamped to MAX_RATE_ADJUST.
+		 * Positive adjust consumes input faster
+		 */
+		void setRateAdjust(double adjust);
+		inline double getRateAdjust() const { return rateAdjust; }
+
+		/**
+		 * Adjusts the rate towards keeping buffered input frames at target.
+		 * Call once per output block, from the consumer
+		 */
+		void updateRate(size_t buffered, size_t target);
+
+		void setVolume(float left, float right);
+
+		inline bool usingSimd() const { return simd; }
+
+	private:
+		// The filter, with one extra phase so phase + 1 is always valid
+		alignas(16) float kernel[PHASES + 1][TAPS];
+
+		// Deinterleaved input. Everything before readIndex has been used up
+		std::vector<float> left;
+		std::vector<float> right;
+		size_t readIndex = 0;
+		// Fractional position past readIndex, in 1/2^32 of an input frame
+		uint32_t fraction = 0;
+
+		double baseStep;
+		double rateAdjust = 0;
+		uint64_t step;
+
+		float volumeLeft = 1;
+		float volumeRight = 1;
+		bool simd;
+
+		void buildKernel(double cutoff);
+		size_t readScalar(int16_t* out, size_t frames);
+#ifdef GB_EMU_SSE2
+		size_t readSSE2(int16_t* out, size_t frames);
+#endif
+		void advance(size_t frames);
+		void discardUsed();
+	};
+}
@@ -4,6 +4,7 @@
  * This file sets constants for all the reserved memory addresses
  */
 
+#include <cstddef>
 #include <cstdint>
 
 namespace gb_emu
@@ -18,6 +19,10 @@ namespace gb_emu
 		SWITCHABLE_ROM_BANK = 0x4000,
 		SWITCHABLE_ROM_BANK_END = 0x7FFF,
 		VRAM_BANK = 0x8000,
+		TILE_DATA_UNSIGNED = 0x8000, // Tile ids 0-255 when LCDC bit 4 is set
+		TILE_DATA_SIGNED = 0x9000, // Tile ids -128-127 when LCDC bit 4 is clear
+		TILE_MAP_0 = 0x9800,
+		TILE_MAP_1 = 0x9C00,
 		VRAM_BANK_END = 0x9FFF,
 		EXTERNAL_RAM_BANK = 0xA000,
 		EXTERNAL_RAM_BANK_END = 0xBFFF,
@@ -32,8 +37,35 @@ namespace gb_emu
 		OAM_TABLE_END = 0xFE9F,
 
 		/** I/O Registers */
+		IO_REGISTERS = 0xFF00,
+		JOYPAD = 0xFF00, // P1
+		SERIAL_DATA = 0xFF01, // SB
+		SERIAL_CONTROL = 0xFF02, // SC
+		DIVIDER = 0xFF04, // DIV
+		TIMER_COUNTER = 0xFF05, // TIMA
+		TIMER_MODULO = 0xFF06, // TMA
+		TIMER_CONTROL = 0xFF07, // TAC
 		INTERRUPT_FLAG = 0xFF0F,
 
+		SOUND_REGISTERS = 0xFF10,
+		SOUND_CONTROL = 0xFF26, // NR52
+		WAVE_RAM = 0xFF30,
+		WAVE_RAM_END = 0xFF3F,
+		SOUND_REGISTERS_END = WAVE_RAM_END,
+
+		LCD_CONTROL = 0xFF40,
+		LCD_STATUS = 0xFF41,
+		SCROLL_Y = 0xFF42,
+		SCROLL_X = 0xFF43,
+		LCD_Y = 0xFF44,
+		LCD_Y_COMPARE = 0xFF45,
+		OAM_DMA = 0xFF46,
+		BG_PALETTE = 0xFF47,
+		OBJ_PALETTE_0 = 0xFF48,
+		OBJ_PALETTE_1 = 0xFF49,
+		WINDOW_Y = 0xFF4A,
+		WINDOW_X = 0xFF4B,
+
 
 		HRAM = 0xFF80,
 		HRAM_END = 0xFFFE,
@@ -45,4 +77,7 @@ namespace gb_emu
 	constexpr size_t MEM_SIZE = 0x10000;
 	constexpr size_t MAX_CARTRIDGE_SIZE = 0x800000;
 	constexpr size_t ROM_BLOCK_SIZE = 0x4000;
+	constexpr size_t VRAM_SIZE = VRAM_BANK_END - VRAM_BANK + 1;
+	constexpr size_t OAM_SIZE = OAM_TABLE_END - OAM_TABLE + 1;
+	constexpr size_t IO_REGISTERS_SIZE = HRAM - IO_REGISTERS;
 }
\ No newline at end of file
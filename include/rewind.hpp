@@ -0,0 +1,103 @@
+#pragma once
+
+#include "common.hpp"
+#include "ringbuffer.hpp"
+#include "savestate.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace gb_emu
+{
+	class VM;
+
+	/**
+	 * Keeps recent per-frame states so play can be stepped backwards.
+	 *
+	 * The emulation thread only copies the state into a free slot. A worker thread XORs it
+	 * against the previous one, which leaves mostly zeros, and stores that
+	 * run length encoded. Only the newest state is kept whole; stepping
+	 * back XORs the newest with its delta to get the one before.
+	 *
+	 * The oldest states are dropped to stay within both the state count
+	 * and the memory limit
+	 */
+	class RewindBuffer
+	{
+	public:
+		RewindBuffer(size_t maxStates, size_t memoryLimit, size_t queueStates = 8);
+		~RewindBuffer();
+		RewindBuffer(const RewindBuffer&) = delete;
+		RewindBuffer& operator=(const RewindBuffer&) = delete;
+
+		/**
+		 * Records the VM's current state. If the worker has fallen behind
+		 * and no slot is free, the state is skipped
+		 */
+		void push(VM& vm);
+
+		/**
+		 * Restores the newest stored state from before the VM's current one
+		 * and discards it, so the next call goes further back. A stored state
+		 * the VM is already in is skipped, so the first step after playing
+		 * goes back a frame. The VM's framebuffer is then the frame which was
+		 * on screen when the restored state was taken. Returns false if
+		 * nothing older is left
+		 */
+		bool stepBack(VM& vm);
+
+		/**
+		 * States available to step back through
+		 */
+		size_t size();
+		/**
+		 * Bytes held by stored deltas, not counting the fixed size slots
+		 */
+		size_t memoryUsed();
+		inline uint64_t getSkippedStates() const { return skippedStates.load(std::memory_order_relaxed); }
+
+	private:
+		struct Snapshot {
+			SaveState state;
+		};
+		static_assert(std::is_trivially_copyable<Snapshot>::value, "Snapshots are XORed as bytes");
+
+		size_t maxStates;
+		size_t memoryLimit;
+
+		std::vector<std::unique_ptr<Snapshot>> slots;
+		// Slots move emulator -> worker through ready, and back through free
+		RingBuffer<uint16_t> freeSlots;
+		RingBuffer<uint16_t> readySlots;
+		std::atomic<uint64_t> skippedStates{ 0 };
+
+		// Guards everything below, which the worker builds and stepBack consumes
+		std::mutex storeMutex;
+		std::unique_ptr<Snapshot> newest;
+		bool haveNewest = false;
+		// deltas[i] turns state i + 1 back into state i, oldest first
+		std::deque<std::vector<uint8_t>> deltas;
+		size_t deltaBytes = 0;
+
+		std::thread worker;
+		std::mutex wakeMutex;
+		std::condition_variable wake;
+		std::atomic<bool> stopping{ false };
+
+		void run();
+		void store(const Snapshot& snapshot);
+		/**
+		 * Steps newest back to the state before it. Needs storeMutex
+		 */
+		void discardNewest();
+		/**
+		 * Waits until everything pushed has been stored
+		 */
+		void drain();
+	};
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace gb_emu
+{
+	/**
+	 * Lock-free single producer, single consumer ring buffer. One thread
+	 * may write while another reads, with no locks on either side.
+	 * Capacity is rounded up to a power of two
+	 */
+	template<typename T>
+	class RingBuffer
+	{
+	public:
+		explicit RingBuffer(size_t minCapacity)
+		{
+			size_t capacity = 1;
+			while(capacity < minCapacity) capacity <<= 1;
+			buffer.resize(capacity);
+			mask = capacity - 1;
+		}
+		RingBuffer(const RingBuffer&) = delete;
+		RingBuffer& operator=(const RingBuffer&) = delete;
+
+		inline size_t capacity() const { return buffer.size(); }
+
+		/**
+		 * Number of items available to read. Exact when called by the consumer,
+		 * a lower bound of free space when called by the producer
+		 */
+		inline size_t size() const
+		{
+			return writePos.load(std::memory_order_acquire) - readPos.load(std::memory_order_acquire);
+		}
+
+		/**
+		 * Producer side. Returns false if full
+		 */
+		bool push(const T& value)
+		{
+			size_t w = writePos.load(std::memory_order_relaxed);
+			if(w - readPos.load(std::memory_order_acquire) == buffer.size()) return false;
+			buffer[w & mask] = value;
+			writePos.store(w + 1, std::memory_order_release);
+			return true;
+		}
+
+		/**
+		 * Consumer side. Returns false if empty
+		 */
+		bool pop(T& value)
+		{
+			size_t r = readPos.load(std::memory_order_relaxed);
+			if(writePos.load(std::memory_order_acquire) == r) return false;
+			value = buffer[r & mask];
+			readPos.store(r + 1, std::memory_order_release);
+			return true;
+		}
+
+		/**
+		 * Producer side. Writes as many of count items as fit, and returns
+		 * how many were written
+		 */
+		size_t write(const T* data, size_t count)
+		{
+			size_t w = writePos.load(std::memory_order_relaxed);
+			size_t space = buffer.size() - (w - readPos.load(std::memory_order_acquire));
+			if(count > space) count = space;
+			for(size_t i = 0; i < count; ++i)
+				buffer[(w + i) & mask] = data[i];
+			writePos.store(w + count, std::memory_order_release);
+			return count;
+		}
+
+		/**
+		 * Consumer side. Reads up to count items, and returns how many were read
+		 */
+		size_t read(T* data, size_t count)
+		{
+			size_t r = readPos.load(std::memory_order_relaxed);
+			size_t available = writePos.load(std::memory_order_acquire) - r;
+			if(count > available) count = available;
+			for(size_t i = 0; i < count; ++i)
+				data[i] = buffer[(r + i) & mask];
+			readPos.store(r + count, std::memory_order_release);
+			return count;
+		}
+
+	private:
+		std::vector<T> buffer;
+		size_t mask;
+		// Kept on separate cache lines so the two threads don't contend
+		alignas(64) std::atomic<size_t> writePos{ 0 };
+		alignas(64) std::atomic<size_t> readPos{ 0 };
+	};
+}
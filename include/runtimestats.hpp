@@ -0,0 +1,144 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <type_traits>
+
+namespace gb_emu
+{
+	class VM;
+
+	/**
+	 * How a VM and the frontend running it are doing. Counts are totals;
+	 * frame times and rates cover the last interval a StatsMonitor
+	 * published. Every field is a uint64_t so StatsSeqlock can copy it a
+	 * word at a time
+	 */
+	struct RuntimeStats {
+		uint64_t cycles;
+		uint64_t instructions;
+		uint64_t frames;
+		// Host time to emulate (and present) a frame, in nanoseconds
+		uint64_t frameTimeP50;
+		uint64_t frameTimeP99;
+		// Emulated frames per host second, times 1000
+		uint64_t framesPerSecondMilli;
+		// Frame deadlines the presenter missed
+		uint64_t droppedFrames;
+		// Audio callbacks which ran out of samples
+		uint64_t audioUnderruns;
+		uint64_t bankSwitches;
+		uint64_t bankSwitchesPerSecond;
+		// Host time since the monitor started, in nanoseconds
+		uint64_t uptime;
+	};
+	static_assert(std::is_trivially_copyable<RuntimeStats>::value && sizeof(RuntimeStats) % sizeof(uint64_t) == 0,
+		"RuntimeStats must be copyable as words");
+
+	/**
+	 * Hands RuntimeStats from one writing thread to any number of readers
+	 * without locks. The writer never waits; a reader which overlaps a
+	 * write reads again
+	 */
+	class StatsSeqlock
+	{
+	public:
+		/**
+		 * Only one thread may store
+		 */
+		void store(const RuntimeStats& stats);
+		RuntimeStats load() const;
+
+	private:
+		static constexpr size_t WORDS = sizeof(RuntimeStats) / sizeof(uint64_t);
+		// Odd while a store is under way
+		std::atomic<uint64_t> sequence{ 0 };
+		std::atomic<uint64_t> words[WORDS] = {};
+	};
+
+	/**
+	 * Durations bucketed with an eighth of a power of two's resolution, so
+	 * percentiles are within 12.5% at any scale in fixed space
+	 */
+	class FrameTimeHistogram
+	{
+	public:
+		void add(uint64_t nanoseconds);
+		/**
+		 * The upper bound of the bucket holding the fraction'th duration,
+		 * 0 if there are none
+		 */
+		uint64_t percentile(double fraction) const;
+		void clear();
+		inline uint64_t getCount() const { return count; }
+
+	private:
+		static constexpr size_t SUB_BUCKETS = 8;
+		static constexpr size_t BUCKETS = 62 * SUB_BUCKETS;
+		uint64_t buckets[BUCKETS] = {};
+		uint64_t count = 0;
+	};
+
+	/**
+	 * Gathers RuntimeStats for a frontend. The emulation thread brackets
+	 * each frame with beginFrame and endFrame, which publishes a snapshot
+	 * once an interval, for read on any thread. Between publishes the only
+	 * cost is timing the frame
+	 */
+	class StatsMonitor
+	{
+	public:
+		using Clock = std::chrono::steady_clock;
+
+		explicit StatsMonitor(std::chrono::milliseconds interval = std::chrono::seconds(1));
+
+		inline void beginFrame() { frameStart = Clock::now(); }
+		/**
+		 * Returns true if this published a new snapshot
+		 */
+		bool endFrame(const VM& vm);
+		/**
+		 * Publishes a snapshot now, whether or not an interval has passed
+		 */
+		void publish(const VM& vm);
+
+		inline void countDroppedFrames(uint64_t frames) { droppedFrames += frames; }
+		/**
+		 * Safe to call from the audio thread
+		 */
+		inline void countAudioUnderrun() { audioUnderruns.fetch_add(1, std::memory_order_relaxed); }
+
+		/**
+		 * The last snapshot published. Safe to call from any thread
+		 */
+		inline RuntimeStats read() const { return published.load(); }
+
+	private:
+		void publish(const VM& vm, Clock::time_point now);
+
+		Clock::duration interval;
+		Clock::time_point start;
+		Clock::time_point frameStart;
+		Clock::time_point lastPublish;
+		Clock::time_point nextPublish;
+		FrameTimeHistogram frameTimes;
+		uint64_t droppedFrames = 0;
+		std::atomic<uint64_t> audioUnderruns{ 0 };
+		// The VM's counts at lastPublish, for rates
+		uint64_t lastFrames = 0;
+		uint64_t lastBankSwitches = 0;
+		StatsSeqlock published;
+	};
+
+	/**
+	 * One line for people
+	 */
+	void printStats(std::FILE* fp, const RuntimeStats& stats);
+	/**
+	 * One JSON object per line
+	 */
+	void writeStatsJSON(std::FILE* fp, const RuntimeStats& stats);
+}
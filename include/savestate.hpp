@@ -0,0 +1,97 @@
+#pragma once
+
+#include "mem.hpp"
+#include "ppu.hpp"
+#include "apu.hpp"
+#include "timer.hpp"
+#include "joypad.hpp"
+#include "serial.hpp"
+#include <cstdint>
+#include <string>
+#include <type_traits>
+
+/**
+ * This file contains the save-state layout. A save-state is one flat,
+ * trivially copyable struct made of each component's State, so saving
+ * and loading are a handful of memcpys and files are the struct's bytes
+ */
+
+namespace gb_emu
+{
+	namespace savestate
+	{
+		constexpr char MAGIC[4] = { 'G', 'B', 'S', 'S' };
+		// Bump whenever any component's State changes
+		constexpr uint32_t VERSION = 3;
+	}
+
+	struct SaveStateHeader {
+		char magic[4];
+		uint32_t version;
+		// sizeof(SaveState), which catches layout differences between builds
+		uint32_t size;
+	};
+
+	/**
+	 * The CPU's registers and the VM's own bookkeeping
+	 */
+	struct CPUState {
+		uint8_t registers[10];
+		uint16_t SP;
+		uint16_t PC;
+		uint64_t cycleCounter;
+		uint8_t interruptEnablePending;
+		bool interruptsEnabled;
+		bool halted;
+		uint64_t frameCount;
+		uint64_t frameHash;
+		uint64_t previousFrameHash;
+	};
+
+	struct SaveState {
+		SaveStateHeader header;
+		CPUState cpu;
+		MMU::State mmu;
+		PPU::State ppu;
+		APU::State apu;
+		Timer::State timer;
+		Joypad::State joypad;
+		Serial::State serial;
+	};
+	static_assert(std::is_trivially_copyable<SaveState>::value, "SaveState must be copyable with memcpy");
+
+	/**
+	 * A save-state holding only the memory pages written since the previous
+	 * delta was taken. Everything else is small, so is always included in
+	 * full. Unlike SaveState the pages are a std::vector, so this isn't
+	 * trivially copyable and isn't written to files as its bytes
+	 */
+	struct DeltaSaveState {
+		SaveStateHeader header;
+		CPUState cpu;
+		MMU::DeltaState mmu;
+		PPU::State ppu;
+		APU::State apu;
+		Timer::State timer;
+		Joypad::State joypad;
+		Serial::State serial;
+	};
+
+	/**
+	 * Brings state forward to the point delta was taken. state must have
+	 * been saved after the VM's previous saveDelta or loadState, or be the
+	 * result of applying the delta before this one
+	 */
+	void applyDelta(SaveState& state, const DeltaSaveState& delta);
+
+	/**
+	 * Whether a state was made by a compatible build
+	 */
+	bool isValid(const SaveState& state);
+
+	bool writeSaveState(const std::string& path, const SaveState& state);
+	/**
+	 * Fails, leaving state untouched, if the file isn't a valid save-state
+	 */
+	bool readSaveState(const std::string& path, SaveState& state);
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "iodevice.hpp"
+#include <cstdint>
+
+namespace gb_emu
+{
+	class MMU;
+	class LinkCable;
+
+	/**
+	 * The serial port, SB and SC (0xFF01-0xFF02). Writing SC with bit 7
+	 * set starts a transfer, clocked by this side if bit 0 is set or by
+	 * the other end of the cable if not. A transfer shifts SB's 8 bits out
+	 * while shifting the other side's in, then clears bit 7 and requests
+	 * the serial interrupt.
+	 *
+	 * With no cable connected nothing is shifted in, so SB reads 0xFF
+	 * after an internally clocked transfer, and an externally clocked one
+	 * never finishes. Like the timer, the only per-instruction cost is
+	 * comparing the clock against one scheduled time
+	 */
+	class Serial : public IODevice
+	{
+	public:
+		static constexpr uint64_t NEVER = ~0ULL;
+		// 8 bits at 8192 Hz
+		static constexpr uint32_t TRANSFER_CYCLES = 4096;
+
+		struct State {
+			uint8_t data;
+			uint8_t control;
+			uint64_t transferEnd;
+		};
+
+		/**
+		 * clock is the CPU's cycle counter
+		 */
+		Serial(MMU& mem, const uint64_t& clock);
+
+		/**
+		 * Whether the transfer, or the cable, needs attention. A single
+		 * comparison, for checking after every instruction
+		 */
+		inline bool due() const { return clock >= nextEvent; }
+
+		/**
+		 * Finishes a transfer which is due, or synchronises with the cable
+		 */
+		void update();
+
+		inline bool isConnected() const { return cable != nullptr; }
+
+		/**
+		 * The cable's state isn't saved, so a state saved while connected
+		 * should be taken with no transfer in flight
+		 */
+		void saveState(State& state) const;
+		void loadState(const State& state);
+
+		uint8_t readIO(uint16_t addr) override;
+		void writeIO(uint16_t addr, uint8_t value) override;
+
+	private:
+		friend class LinkCable;
+
+		MMU& mem;
+		const uint64_t& clock;
+
+		uint8_t data = 0;
+		// Bits 7 and 0 as last written
+		uint8_t control = 0;
+		// When the transfer this side is clocking ends, NEVER if none is
+		uint64_t transferEnd = NEVER;
+		uint64_t nextEvent = NEVER;
+
+		LinkCable* cable = nullptr;
+		// Which end of the cable this is
+		int side = 0;
+
+		inline bool internalClock() const { return control & 0x01; }
+		void schedule();
+		/**
+		 * Ends a transfer: received replaces SB, bit 7 of SC is cleared and
+		 * the serial interrupt requested
+		 */
+		void finish(uint8_t received);
+	};
+}
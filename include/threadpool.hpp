@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace gb_emu
+{
+	/**
+	 * A fixed set of worker threads, each with its own task queue.
+	 *
+	 * A task submitted from a worker goes on the back of that worker's own
+	 * queue, and workers take from the back of their own queue first, so a
+	 * task which resubmits itself stays on the thread whose cache it has
+	 * warmed. A worker with nothing to do steals from the front of the
+	 * others' queues, which keeps every core busy when work is uneven
+	 */
+	class WorkStealingPool
+	{
+	public:
+		using Task = std::function<void()>;
+
+		/**
+		 * 0 threads means one per hardware thread
+		 */
+		explicit WorkStealingPool(size_t threads = 0);
+		~WorkStealingPool();
+		WorkStealingPool(const WorkStealingPool&) = delete;
+		WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+		/**
+		 * Queues a task. From outside the pool, tasks are dealt round robin
+		 */
+		void submit(Task task);
+
+		/**
+		 * Blocks until every task, including those submitted by tasks, has run
+		 */
+		void wait();
+
+		inline size_t getThreadCount() const { return threads.size(); }
+
+		/**
+		 * Tasks run by a worker other than the one whose queue they were on
+		 */
+		inline uint64_t getSteals() const { return steals.load(std::memory_order_relaxed); }
+
+	private:
+		struct Queue {
+			std::mutex mutex;
+			std::deque<Task> tasks;
+		};
+
+		std::vector<std::unique_ptr<Queue>> queues;
+		std::vector<std::thread> threads;
+
+		// Tasks sitting in queues. Only raised with sleepMutex held, so a
+		// worker about to sleep can't miss one
+		std::atomic<size_t> queued{ 0 };
+		// Tasks queued or running, for wait
+		std::atomic<size_t> unfinished{ 0 };
+		std::atomic<uint64_t> steals{ 0 };
+		std::atomic<size_t> nextQueue{ 0 };
+		bool stopping = false;
+
+		std::mutex sleepMutex;
+		std::condition_variable wake;
+		std::condition_variable idle;
+
+		void workerLoop(size_t index);
+		bool take(size_t index, Task& task);
+	};
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+/**
+ * This file contains the background layer cache, which keeps both tile
+ * maps decoded into 256x256 layers of colour numbers
+ */
+
+namespace gb_emu
+{
+	/**
+	 * Decoded copies of the two 32x32 tile maps at 0x9800 and 0x9C00, so a
+	 * background or window line is just an offset copy out of the layer.
+	 *
+	 * Writes only bump version counters. Before a row of the layer is read,
+	 * its 32 map entries are checked against the tile each was last drawn
+	 * with, and only entries whose tile id or tile data changed are redrawn.
+	 * The check itself is skipped when nothing in VRAM has changed since
+	 * the row was last validated
+	 */
+	class TileMapCache
+	{
+	public:
+		static constexpr std::size_t LAYER_SIZE = 256;
+		static constexpr std::size_t MAP_SIZE = 32;
+		static constexpr std::size_t TILE_COUNT = 384;
+
+		TileMapCache();
+
+		/**
+		 * Records a write to VRAM. addr is absolute (0x8000-0x9FFF)
+		 */
+		void write(uint16_t addr);
+
+		/**
+		 * Forgets everything drawn, for when VRAM has been replaced wholesale
+		 */
+		void invalidate();
+
+		/**
+		 * Gets a LAYER_SIZE row of colour numbers (0-3, before the palette is
+		 * applied) for line y of tile map 0 or 1. unsignedTileData follows
+		 * LCDC bit 4, and vram points to 0x8000
+		 */
+		const uint8_t* row(uint8_t map, uint8_t y, bool unsignedTileData, const uint8_t* vram);
+
+		/**
+		 * Bytes of layer allocated. Each layer is allocated on its first row,
+		 * so an instance which never draws that map doesn't pay for it
+		 */
+		inline std::size_t getHeapSize() const { return ((layers[0] ? 1 : 0) + (layers[1] ? 1 : 0)) * LAYER_SIZE * LAYER_SIZE; }
+
+	private:
+		static constexpr uint16_t NO_TILE = 0xFFFF;
+
+		std::unique_ptr<uint8_t[]> layers[2];
+
+		// Bumped whenever anything in VRAM changes, and on tile data mode changes
+		uint32_t vramVersion = 1;
+		bool lastUnsignedTileData = false;
+		// vramVersion when each tile row of each map was last brought up to date
+		uint32_t rowVersion[2][MAP_SIZE] = {};
+
+		// Bumped on writes to each tile's data
+		uint32_t tileVersion[TILE_COUNT] = {};
+		// The tile (0-383) and its version that each map entry was drawn with
+		uint16_t entryTile[2][MAP_SIZE * MAP_SIZE];
+		uint32_t entryVersion[2][MAP_SIZE * MAP_SIZE] = {};
+
+		void validateRow(uint8_t map, uint8_t tileRow, bool unsignedTileData, const uint8_t* vram);
+		void drawEntry(uint8_t map, uint16_t entry, uint16_t tile, const uint8_t* vram);
+	};
+}
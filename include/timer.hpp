@@ -0,0 +1,85 @@
+#pragma once
+
+#include "iodevice.hpp"
+#include <cstdint>
+
+namespace gb_emu
+{
+	class MMU;
+
+	/**
+	 * DIV and TIMA/TMA/TAC (0xFF04-0xFF07), without any per-cycle work.
+	 *
+	 * DIV is the top byte of a 16 bit counter, which is just the CPU's
+	 * clock since the last DIV write. TIMA counts falling edges of one of
+	 * that counter's bits, so its value at any time can be worked out from
+	 * the value it had when last written. The only thing which has to
+	 * happen at a particular time is the overflow, so that is kept as a
+	 * single scheduled time, recalculated whenever TIMA, TMA, TAC or DIV
+	 * is written
+	 */
+	class Timer : public IODevice
+	{
+	public:
+		static constexpr uint64_t NEVER = ~0ULL;
+
+		struct State {
+			uint64_t divBase;
+			uint8_t tima;
+			uint8_t tma;
+			uint8_t tac;
+			uint64_t timaTime;
+			uint64_t nextOverflow;
+		};
+
+		/**
+		 * clock is the CPU's cycle counter
+		 */
+		Timer(MMU& mem, const uint64_t& clock);
+
+		/**
+		 * Whether the overflow is due. A single comparison, for checking
+		 * after every instruction
+		 */
+		inline bool due() const { return clock >= nextOverflow; }
+
+		/**
+		 * Brings TIMA up to the CPU's clock, reloading it and requesting the
+		 * timer interrupt for any overflow on the way
+		 */
+		void update();
+
+		inline uint64_t getNextOverflow() const { return nextOverflow; }
+
+		void saveState(State& state) const;
+		void loadState(const State& state);
+
+		uint8_t readIO(uint16_t addr) override;
+		void writeIO(uint16_t addr, uint8_t value) override;
+
+	private:
+		MMU& mem;
+		const uint64_t& clock;
+
+		// Clock value when the divider was last reset
+		uint64_t divBase = 0;
+
+		uint8_t tima = 0;
+		uint8_t tma = 0;
+		uint8_t tac = 0;
+		// Clock value tima was last brought up to
+		uint64_t timaTime = 0;
+		uint64_t nextOverflow = NEVER;
+
+		inline bool enabled() const { return tac & 0x4; }
+		/**
+		 * Cycles between TIMA increments for the selected input clock
+		 */
+		uint32_t period() const;
+		/**
+		 * TIMA increments in (from, to]
+		 */
+		uint64_t edgesBetween(uint64_t from, uint64_t to) const;
+		void schedule();
+	};
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "savestate.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Execution trace for post-mortem debugging. A VM with tracing on writes
+ * a TraceRecord per instruction into a fixed size ring, overwriting the
+ * oldest, so the last few thousand instructions before a crash can be
+ * dumped to a file and read back with gb_trace.
+ *
+ * A trace file is a TraceHeader, holding the CPU when it was dumped,
+ * followed by the records oldest first, in this build's byte order
+ */
+
+namespace gb_emu
+{
+	namespace trace
+	{
+		constexpr char MAGIC[4] = { 'G', 'B', 'T', 'R' };
+		// Bump whenever TraceHeader or TraceRecord changes
+		constexpr uint32_t VERSION = 1;
+	}
+
+	/**
+	 * One instruction, taken before it executed
+	 */
+	struct TraceRecord {
+		uint16_t pc;
+		// ROM bank at pc, truncated to 8 bits (only MBC5 goes higher)
+		uint8_t bank;
+		uint8_t opcode;
+		// The two bytes after the opcode, whether the instruction uses them or not
+		uint8_t operands[2];
+		// Cycles since the previous record, including halts and interrupt
+		// dispatch. Saturates at 0xFFFF, which only a long halt or loading
+		// a state reaches
+		uint16_t cycles;
+		// B, C, D, E, H, L, A, F, as VM keeps them
+		uint8_t registers[8];
+	};
+	static_assert(sizeof(TraceRecord) == 16, "TraceRecord should stay 16 bytes");
+
+	struct TraceHeader {
+		char magic[4];
+		uint32_t version;
+		// sizeof(TraceRecord), which catches layout differences between builds
+		uint32_t recordSize;
+		// Records in the file
+		uint32_t records;
+		// Instructions traced in all, including those overwritten
+		uint64_t total;
+		// cycleCounter when the newest record was taken
+		uint64_t lastCycles;
+		// The CPU when the trace was dumped
+		CPUState cpu;
+	};
+
+	class TraceRing
+	{
+	public:
+		static constexpr size_t DEFAULT_CAPACITY = 1 << 16;
+
+		/**
+		 * Capacity is rounded up to a power of two. startCycles is the VM's
+		 * cycleCounter now, which the first record's cycles count from
+		 */
+		explicit TraceRing(size_t minCapacity = DEFAULT_CAPACITY, uint64_t startCycles = 0);
+
+		/**
+		 * The record to fill in for the instruction starting at cycleCounter
+		 */
+		inline TraceRecord& append(uint64_t cycleCounter)
+		{
+			TraceRecord& record = records[total++ & mask];
+			uint64_t elapsed = cycleCounter - lastCycles;
+			record.cycles = static_cast<uint16_t>(elapsed < 0xFFFF ? elapsed : 0xFFFF);
+			lastCycles = cycleCounter;
+			return record;
+		}
+
+		inline size_t capacity() const { return records.size(); }
+		inline uint64_t getTotal() const { return total; }
+
+		/**
+		 * Writes the records held, oldest first, after a header holding cpu.
+		 * Returns false if the file can't be written
+		 */
+		bool write(const std::string& path, const CPUState& cpu) const;
+
+	private:
+		std::vector<TraceRecord> records;
+		size_t mask;
+		uint64_t total = 0;
+		uint64_t lastCycles;
+	};
+
+	/**
+	 * Reads a trace written by TraceRing::write. Returns false, leaving
+	 * header and records alone, if it isn't a trace from this version
+	 */
+	bool readTrace(const std::string& path, TraceHeader& header, std::vector<TraceRecord>& records);
+}
@@ -4,7 +4,18 @@
 #include "op_code.hpp"
 #include "debug.hpp"
 #include "mem.hpp"
+#include "ppu.hpp"
+#include "apu.hpp"
+#include "timer.hpp"
+#include "joypad.hpp"
+#include "serial.hpp"
+#include "opcodestats.hpp"
+#include "profiler.hpp"
+#include "trace.hpp"
+#include "savestate.hpp"
 #include <cstdint>
+#include <memory>
+#include <string>
 
 namespace gb_emu
 {
@@ -73,15 +84,200 @@ namespace gb_emu
 		RUNTIME_ERROR,
 	};
 
+	class VMPool;
+
+	/**
+	 * Memory one VM uses, in bytes
+	 */
+	struct Footprint {
+		// The VM object itself, wherever it was allocated
+		size_t object = 0;
+		// Heap owned by this VM alone
+		size_t heap = 0;
+		// Decoded tile layers and the ARGB frame, allocated on first use by
+		// instances which draw and present, and rebuilt from state if lost
+		size_t caches = 0;
+		// The cartridge and frozen memory images, shared with forks so not in total
+		size_t shared = 0;
+		// Pages of writable memory this VM has its own copy of
+		size_t ownedPages = 0;
+
+		// What FOOTPRINT_BUDGET covers: everything but the caches
+		inline size_t total() const { return object + heap; }
+	};
+
 	class VM {
+		// Constructs VMs in its own storage
+		friend class VMPool;
 	public:
-		VM() { mem.loadFromFile("Tetris (W) (V1.0) [!].gb"); }
+		/**
+		 * What a running VM may use, object and heap together, with audio
+		 * output disabled. That's its state (32 KB of memory and the 23 KB
+		 * frame) plus the tile cache's bookkeeping. The caches in Footprint
+		 * come on top, and the cartridge is shared and not counted
+		 */
+		static constexpr size_t FOOTPRINT_BUDGET = 96 * 1024;
+
+		/**
+		 * Loads the cartridge at romPath. Check isLoaded afterwards
+		 */
+		explicit VM(const std::string& romPath);
 		ExecuteResult run();
+
+		/**
+		 * Whether a cartridge was loaded successfully
+		 */
+		inline bool isLoaded() const { return mem.isLoaded(); }
+
+		/**
+		 * Runs until the PPU completes a frame (enters vblank)
+		 */
+		ExecuteResult runFrame();
+
+		/**
+		 * Runs at most budget frames, stopping early on an error. frames is
+		 * set to the number completed. Lets a scheduler advance many VMs in
+		 * slices
+		 */
+		ExecuteResult runFrames(uint64_t budget, uint64_t& frames);
+
+		/**
+		 * Runs just the next instruction, with none of the interrupt, timer
+		 * or PPU work done between instructions. For measuring the
+		 * interpreter on its own
+		 */
+		inline ExecuteResult executeInstruction() { return fetchDecodeExecute(); }
+
+		/**
+		 * The last completed frame, SCREEN_WIDTH * SCREEN_HEIGHT ARGB8888 pixels.
+		 * Built on first call, so only instances which present pay for it
+		 */
+		inline const uint32_t* getFramebuffer() const { return ppu.getFramebuffer(); }
+
+		/**
+		 * Hash of the last completed frame's shade numbers. A stream of these
+		 * is a cheap determinism check
+		 */
+		inline uint64_t getFrameHash() const { return frameHash; }
+
+		/**
+		 * Whether the last completed frame differs from the one before it.
+		 * Unchanged frames don't need to be presented or encoded again
+		 */
+		inline bool frameChanged() const { return frameHash != previousFrameHash; }
+
+		/**
+		 * Number of frames completed so far
+		 */
+		inline uint64_t getFrameCount() const { return frameCount; }
+
+		/**
+		 * Instructions executed since this VM was created, not counting
+		 * cycles spent halted. Not part of save-states or forks
+		 */
+		inline uint64_t getInstructionCount() const { return instructionCount; }
+
+		/**
+		 * Emulated clock cycles run so far. Restored by loadState
+		 */
+		inline uint64_t getCycleCount() const { return cycleCounter; }
+
+		/**
+		 * ROM bank switches since this VM was created
+		 */
+		inline uint64_t getBankSwitches() const { return mem.getBankSwitches(); }
+
+		/**
+		 * Counts per opcode, when built with GB_EMU_OPCODE_STATS. Otherwise
+		 * a NoOpcodeStats, which counts nothing
+		 */
+		inline OpcodeStatsPolicy& getOpcodeStats() { return opcodeStats; }
+
+		/**
+		 * Starts sampling into profiler, which must outlive the VM or be
+		 * detached by passing null. Sampling starts an interval from now
+		 */
+		void setProfiler(Profiler* profiler);
+
+		/**
+		 * Starts recording the last records instructions (rounded up to a
+		 * power of two) for dumpTrace. 0 stops recording and frees the ring
+		 */
+		void enableTrace(size_t records = TraceRing::DEFAULT_CAPACITY);
+		/**
+		 * Writes the instructions recorded since enableTrace, e.g. after a
+		 * RUNTIME_ERROR. The last is the one that failed, if one did. Returns
+		 * false if tracing is off or the file can't be written
+		 */
+		bool dumpTrace(const std::string& path) const;
+
+		/**
+		 * The sound unit, whose output ring the frontend drains
+		 */
+		inline APU& getAPU() { return apu; }
+
+		/**
+		 * Button state is set here by the frontend or a movie, once per frame
+		 */
+		inline Joypad& getJoypad() { return joypad; }
+
+		/**
+		 * The serial port, which a LinkCable connects to another VM's
+		 */
+		inline Serial& getSerial() { return serial; }
+
+		/**
+		 * Snapshots the whole machine. Only valid between frames or
+		 * instructions, never from within one
+		 */
+		void saveState(SaveState& state);
+		/**
+		 * Returns false, changing nothing, if the state is from an
+		 * incompatible build. The same ROM must be loaded
+		 */
+		bool loadState(const SaveState& state);
+
+		/**
+		 * Snapshots the machine, with only the memory pages written since
+		 * the last saveDelta or loadState. saveState leaves the pages being
+		 * tracked alone, so full snapshots (rewind, quick save) can be
+		 * taken in between without breaking a chain of deltas
+		 */
+		void saveDelta(DeltaSaveState& delta);
+
+		/**
+		 * A copy of the machine as it is now, which then runs independently.
+		 * Memory is shared copy on write, so a fork costs only the pages
+		 * either side goes on to write. Same restrictions as saveState
+		 */
+		std::unique_ptr<VM> fork();
+
+		/**
+		 * Pages of memory this VM has its own copy of, rather than sharing
+		 * with the VMs it was forked from or into
+		 */
+		inline size_t getOwnedPageCount() const { return mem.getOwnedPageCount(); }
+
+		Footprint getFootprint() const;
 	private:
+		struct ForkTag {};
+		/**
+		 * A VM with nothing loaded, for fork to fill in
+		 */
+		explicit VM(ForkTag);
+		/**
+		 * Makes child, which must be fresh from VM(ForkTag), a fork of this
+		 */
+		void forkInto(VM& child);
+		/**
+		 * Routes the I/O registers to this VM's hardware units
+		 */
+		void mapDevices();
 
 		uint16_t SP = 0xFFFE;
 		uint16_t PC = 0;
-		uint32_t cycleCounter = 0;
+		// 64 bits so timestamps taken from it never wrap
+		uint64_t cycleCounter = 0;
 		inline void cycles(uint32_t num) { cycleCounter += num; }
 
 		// Union for handling 8 bit registers and addressing them as pairs
@@ -99,9 +295,45 @@ namespace gb_emu
 		 * interrupt flag and clear this register
 		 */
 		uint8_t interruptEnablePending = 0;
+		// IME, which gates all interrupts regardless of IE
+		bool interruptsEnabled = false;
+		// HALT stops fetching until an enabled interrupt is requested
+		bool halted = false;
 
 		MMU mem;
+		PPU ppu;
+		APU apu;
+		Timer timer;
+		Joypad joypad;
+		Serial serial;
+
+		uint64_t frameCount = 0;
+		uint64_t instructionCount = 0;
+		OpcodeStatsPolicy opcodeStats;
+
+		Profiler* profiler = nullptr;
+		// cycleCounter value of the next profile sample, never if no profiler
+		uint64_t nextProfileSample = ~0ULL;
+		void sampleProfile();
+		inline void profileCall(uint16_t site) { if(profiler) profiler->onCall(mem.getBank(site), site, SP); }
+
+		std::unique_ptr<TraceRing> trace;
+		void traceInstruction();
+		uint64_t frameHash = 0;
+		// Differs from any real hash at the start so the first frame counts as changed
+		uint64_t previousFrameHash = ~0ULL;
 		
+		/**
+		 * Runs one instruction (or one cycle of HALT) and everything after
+		 * it. Returns true if that completed a frame
+		 */
+		bool step(ExecuteResult& result);
+		/**
+		 * Interrupts, timers and the PPU, after an instruction which started
+		 * at startCycles. Returns true if that completed a frame
+		 */
+		bool finishInstruction(uint64_t startCycles);
+
 		ExecuteResult fetchDecodeExecute();
 		/**
 		 * Fetches the next byte and increments the program counter
@@ -247,6 +479,15 @@ namespace gb_emu
 
 		void enableInterrupts();
 		void disableInterrupts();
+		/**
+		 * Jumps to the handler of the highest priority interrupt which is
+		 * both enabled and requested, if IME allows. Also wakes from HALT
+		 */
+		void serviceInterrupts();
+
+		void saveHeader(SaveStateHeader& header) const;
+		void saveCPU(CPUState& cpu) const;
+		void loadCPU(const CPUState& cpu);
 
 		void doPrefixCBCommand();
 		void doArithmeticCommand(Opcode_Arithmetic_Command cmd, uint8_t operand);
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "common.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace gb_emu
+{
+	class VM;
+
+	/**
+	 * Fixed size storage for many VMs in one contiguous arena, so instances
+	 * sit next to each other rather than scattered around the heap. With
+	 * hugePages the arena is backed by 2 MB pages where the OS allows,
+	 * which cuts TLB misses when stepping thousands of instances; if huge
+	 * pages can't be had, normal pages are used instead.
+	 *
+	 * The arena is reserved up front, but the OS only commits the pages of
+	 * it which are touched. VMs hold a little heap of their own as well
+	 * (see VM::getFootprint), which isn't in the arena
+	 */
+	class VMPool
+	{
+	public:
+		struct Deleter {
+			VMPool* pool;
+			void operator()(VM* vm) const;
+		};
+		using Handle = std::unique_ptr<VM, Deleter>;
+
+		explicit VMPool(size_t capacity, bool hugePages = false);
+		~VMPool();
+		VMPool(const VMPool&) = delete;
+		VMPool& operator=(const VMPool&) = delete;
+
+		/**
+		 * A new VM with romPath loaded, or null if the pool is full. Check
+		 * isLoaded as for VM's own constructor
+		 */
+		Handle create(const std::string& romPath);
+
+		/**
+		 * A fork of parent (see VM::fork), or null if the pool is full
+		 */
+		Handle fork(VM& parent);
+
+		inline size_t capacity() const { return slotCount; }
+		size_t size() const;
+
+		/**
+		 * Bytes per VM, sizeof(VM) rounded up to a cache line
+		 */
+		inline size_t getSlotSize() const { return slotSize; }
+		inline bool usingHugePages() const { return hugePages; }
+
+	private:
+		uint8_t* arena = nullptr;
+		size_t arenaSize = 0;
+		size_t slotSize;
+		size_t slotCount;
+		bool hugePages = false;
+		// Whether arena came from the OS's page allocator rather than new
+		bool mapped = false;
+
+		mutable std::mutex mutex;
+		std::vector<uint32_t> freeSlots;
+
+		void* allocate();
+		void release(VM* vm);
+	};
+}
@@ -0,0 +1,594 @@
+#include "../include/apu.hpp"
+#include "../include/reservedAddresses.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iterator>
+
+namespace gb_emu
+{
+	namespace
+	{
+		// Bits which always read back as 1, for 0xFF10-0xFF3F
+		constexpr uint8_t READ_MASKS[SOUND_REGISTERS_END - SOUND_REGISTERS + 1] = {
+			0x80, 0x3F, 0x00, 0xFF, 0xBF, // NR10-NR14
+			0xFF, 0x3F, 0x00, 0xFF, 0xBF, // NR20-NR24
+			0x7F, 0xFF, 0x9F, 0xFF, 0xBF, // NR30-NR34
+			0xFF, 0xFF, 0x00, 0x00, 0xBF, // NR40-NR44
+			0x00, 0x00, 0x70, // NR50-NR52
+			0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+			// Wave RAM
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		};
+
+		// Square wave duty cycles, one bit per step
+		constexpr uint8_t DUTY_PATTERNS[4] = { 0x01, 0x81, 0x87, 0x7E };
+
+		constexpr uint8_t NOISE_DIVISORS[8] = { 8, 16, 32, 48, 64, 80, 96, 112 };
+
+		// Output per unit of channel level * master volume. 4 channels at
+		// full level and volume is 4 * 15 * 8 * 64 = 30720, within int16
+		constexpr int32_t VOLUME_UNIT = 64;
+
+		// Registers within each channel's five
+		enum ChannelRegister : uint8_t {
+			NRx0 = 0,
+			NRx1 = 1,
+			NRx2 = 2,
+			NRx3 = 3,
+			NRx4 = 4,
+		};
+
+		// Registers which are used outside of their channel's write handling
+		enum NamedRegister : uint16_t {
+			NR10 = 0xFF10,
+			NR32 = 0xFF1C,
+			NR43 = 0xFF22,
+			NR50 = 0xFF24,
+			NR51 = 0xFF25,
+		};
+	}
+
+	int32_t BlipBuffer::kernel[BlipBuffer::PHASES][BlipBuffer::KERNEL_TAPS];
+
+	void BlipBuffer::buildKernel()
+	{
+		// Blackman windowed sinc low pass at 45% of the sample rate. Each
+		// phase is normalised to sum to exactly 1 << KERNEL_BITS, so the
+		// integrated step always settles on the full delta
+		const double pi = 3.14159265358979323846;
+		const double cutoff = 0.45;
+		for(int phase = 0; phase < PHASES; ++phase) {
+			double taps[KERNEL_TAPS];
+			double sum = 0;
+			for(int k = 0; k < KERNEL_TAPS; ++k) {
+				double x = k - (KERNEL_TAPS / 2 - 1) - static_cast<double>(phase) / PHASES;
+				double sinc = x == 0 ? 1.0 : std::sin(2 * pi * cutoff * x) / (2 * pi * cutoff * x);
+				double w = x / KERNEL_TAPS;
+				double window = (std::abs(w) > 0.5) ? 0 : 0.42 + 0.5 * std::cos(2 * pi * w) + 0.08 * std::cos(4 * pi * w);
+				taps[k] = sinc * window;
+				sum += taps[k];
+			}
+			int32_t total = 0;
+			int biggest = 0;
+			for(int k = 0; k < KERNEL_TAPS; ++k) {
+				kernel[phase][k] = static_cast<int32_t>(std::lround(taps[k] / sum * (1 << KERNEL_BITS)));
+				total += kernel[phase][k];
+				if(kernel[phase][k] > kernel[phase][biggest]) biggest = k;
+			}
+			kernel[phase][biggest] += (1 << KERNEL_BITS) - total;
+		}
+	}
+
+	BlipBuffer::BlipBuffer(size_t maxSamples) : deltas(maxSamples + KERNEL_TAPS, 0)
+	{
+		// Built once, safely even when VMs are created on several threads
+		static const bool kernelReady = (buildKernel(), true);
+		(void)kernelReady;
+	}
+
+	void BlipBuffer::addDelta(uint64_t time, int32_t delta)
+	{
+		// Anything earlier lands on the first sample, rather than before deltas
+		time = std::max(time, firstSample * CLOCKS_PER_SAMPLE);
+		size_t pos = static_cast<size_t>(time / CLOCKS_PER_SAMPLE - firstSample);
+		const int32_t* k = kernel[(time % CLOCKS_PER_SAMPLE) * PHASES / CLOCKS_PER_SAMPLE];
+		int32_t* out = &deltas[pos];
+		for(int i = 0; i < KERNEL_TAPS; ++i)
+			out[i] += delta * k[i];
+	}
+
+	void BlipBuffer::endBlock(uint64_t time)
+	{
+		available = static_cast<size_t>(time / CLOCKS_PER_SAMPLE - firstSample);
+	}
+
+	void BlipBuffer::reset(uint64_t time)
+	{
+		std::fill(deltas.begin(), deltas.end(), 0);
+		firstSample = time / CLOCKS_PER_SAMPLE;
+		available = 0;
+		integrator = 0;
+		dcLevel = 0;
+	}
+
+	size_t BlipBuffer::readSamples(int16_t* out, size_t count, size_t stride)
+	{
+		count = std::min(count, available);
+		for(size_t i = 0; i < count; ++i) {
+			integrator += deltas[i];
+			int32_t sample = integrator >> KERNEL_BITS;
+			// Remove DC like the capacitor on the real output, time constant ~16ms
+			int32_t filtered = sample - static_cast<int32_t>(dcLevel >> 16);
+			dcLevel += ((static_cast<int64_t>(sample) << 16) - dcLevel) >> 10;
+			out[i * stride] = static_cast<int16_t>(std::min(std::max(filtered, -32768), 32767));
+		}
+
+		// Keep the tail of deltas which haven't been reached yet
+		size_t remaining = available - count + KERNEL_TAPS;
+		std::memmove(deltas.data(), deltas.data() + count, remaining * sizeof(int32_t));
+		std::fill(deltas.begin() + remaining, deltas.begin() + remaining + count, 0);
+		firstSample += count;
+		available -= count;
+		return count;
+	}
+
+	APU::APU(const uint64_t& clock) :
+		clock(clock),
+		leftBuffer(MAX_BLOCK_CYCLES / BlipBuffer::CLOCKS_PER_SAMPLE + 1),
+		rightBuffer(MAX_BLOCK_CYCLES / BlipBuffer::CLOCKS_PER_SAMPLE + 1),
+		mixBuffer((MAX_BLOCK_CYCLES / BlipBuffer::CLOCKS_PER_SAMPLE + 1) * 2)
+	{
+		for(uint8_t i = 0; i < 4; ++i)
+			updatePeriod(i);
+	}
+
+	void APU::sync()
+	{
+		// Keep about a frame and a half queued
+		if(outputEnabled && output->size() < SAMPLE_RATE / 40 * 2)
+			run(clock);
+	}
+
+	void APU::setOutputEnabled(bool enabled)
+	{
+		catchUp();
+		if(enabled && !outputEnabled) {
+			getOutput();
+			// Nothing was synthesized while disabled, so start again from now
+			for(SoundChannel& c : channels)
+				c.nextStep = clock + c.period;
+			outputEnabled = true;
+			restartOutput();
+		}
+		outputEnabled = enabled;
+	}
+
+	RingBuffer<int16_t>& APU::getOutput()
+	{
+		// A quarter of a second of stereo samples
+		if(!output)
+			output = std::make_unique<RingBuffer<int16_t>>(SAMPLE_RATE / 2);
+		return *output;
+	}
+
+	size_t APU::getHeapSize() const
+	{
+		return (leftBuffer.getCapacity() + rightBuffer.getCapacity()) * sizeof(int32_t)
+			+ mixBuffer.capacity() * sizeof(int16_t)
+			+ (output ? output->capacity() * sizeof(int16_t) : 0);
+	}
+
+	void APU::restartOutput()
+	{
+		leftBuffer.reset(lastUpdate);
+		rightBuffer.reset(lastUpdate);
+		for(SoundChannel& c : channels)
+			c.left = c.right = 0;
+		remix(lastUpdate);
+	}
+
+	void APU::saveState(State& state)
+	{
+		catchUp();
+		std::copy(std::begin(registers), std::end(registers), state.registers);
+		state.power = power;
+		std::copy(std::begin(channels), std::end(channels), state.channels);
+		state.sweepTimer = sweepTimer;
+		state.sweepEnabled = sweepEnabled;
+		state.sweepShadow = sweepShadow;
+		state.lfsr = lfsr;
+		state.sequencerStep = sequencerStep;
+		state.nextSequencerTime = nextSequencerTime;
+		state.lastUpdate = lastUpdate;
+	}
+
+	void APU::loadState(const State& state)
+	{
+		std::copy(std::begin(state.registers), std::end(state.registers), registers);
+		power = state.power;
+		std::copy(std::begin(state.channels), std::end(state.channels), channels);
+		sweepTimer = state.sweepTimer;
+		sweepEnabled = state.sweepEnabled;
+		sweepShadow = state.sweepShadow;
+		lfsr = state.lfsr;
+		sequencerStep = state.sequencerStep;
+		nextSequencerTime = state.nextSequencerTime;
+		lastUpdate = state.lastUpdate;
+		if(outputEnabled) {
+			rebaseChannels();
+			restartOutput();
+		}
+	}
+
+	void APU::rebaseChannels()
+	{
+		// A state saved with output off has waveforms which stopped stepping
+		// when it was disabled. Step them on to lastUpdate, as they would
+		// have gone, rather than synthesize the time in between
+		for(uint8_t i = 0; i < 4; ++i) {
+			SoundChannel& c = channels[i];
+			if(c.nextStep >= lastUpdate) continue;
+			if(c.period == 0) {
+				c.nextStep = lastUpdate;
+				continue;
+			}
+			uint64_t steps = (lastUpdate - c.nextStep + c.period - 1) / c.period;
+			c.nextStep += steps * c.period;
+			// Noise has no position; its shift register just carries on from where it stopped
+			if(i < 2)
+				c.position = static_cast<uint8_t>((c.position + steps) & 7);
+			else if(i == 2)
+				c.position = static_cast<uint8_t>((c.position + steps) & 31);
+		}
+	}
+
+	uint8_t APU::readIO(uint16_t addr)
+	{
+		if(addr == SOUND_CONTROL) {
+			// Channel status bits change as lengths expire, so catch up first
+			catchUp();
+			uint8_t status = power ? 0x80 : 0;
+			for(uint8_t i = 0; i < 4; ++i)
+				if(channels[i].enabled) status |= (1 << i);
+			return status | READ_MASKS[addr - SOUND_REGISTERS];
+		}
+		return reg(addr) | READ_MASKS[addr - SOUND_REGISTERS];
+	}
+
+	void APU::writeIO(uint16_t addr, uint8_t value)
+	{
+		// Everything before this write has to be synthesized with the old values
+		catchUp();
+
+		if(addr >= WAVE_RAM) {
+			reg(addr) = value;
+			return;
+		}
+		if(addr == SOUND_CONTROL) {
+			bool on = value & 0x80;
+			if(power && !on) powerOff();
+			else if(!power && on) sequencerStep = 0;
+			power = on;
+			return;
+		}
+		// All other registers are read only while powered off
+		if(!power) return;
+
+		reg(addr) = value;
+		if(addr == NR50 || addr == NR51) {
+			remix(clock);
+			return;
+		}
+
+		uint8_t index = static_cast<uint8_t>((addr - SOUND_REGISTERS) / 5);
+		if(index > 3) return;
+		SoundChannel& c = channels[index];
+		switch((addr - SOUND_REGISTERS) % 5) {
+		case NRx0:
+			if(index == 2) {
+				c.dacEnabled = value & 0x80;
+				if(!c.dacEnabled) disable(index, clock);
+			}
+			break;
+		case NRx1:
+			if(index == 2)
+				c.lengthCounter = 256 - value;
+			else
+				c.lengthCounter = 64 - (value & 0x3F);
+			break;
+		case NRx2:
+			if(index != 2) {
+				c.dacEnabled = (value & 0xF8) != 0;
+				if(!c.dacEnabled) disable(index, clock);
+			}
+			break;
+		case NRx3:
+			c.frequency = (c.frequency & 0x700) | value;
+			updatePeriod(index);
+			break;
+		case NRx4:
+			c.frequency = (c.frequency & 0xFF) | ((value & 0x07) << 8);
+			updatePeriod(index);
+			c.lengthEnabled = value & 0x40;
+			if(value & 0x80) trigger(index);
+			break;
+		}
+	}
+
+	void APU::run(uint64_t until)
+	{
+		while(lastUpdate < until) {
+			uint64_t end = std::min({ until, nextSequencerTime, lastUpdate + MAX_BLOCK_CYCLES });
+			runSquare(0, end);
+			runSquare(1, end);
+			runWave(end);
+			runNoise(end);
+			lastUpdate = end;
+
+			if(end == nextSequencerTime) {
+				clockSequencer(end);
+				nextSequencerTime += SEQUENCER_PERIOD;
+			}
+			leftBuffer.endBlock(end);
+			rightBuffer.endBlock(end);
+			flushSamples();
+		}
+	}
+
+	void APU::runSequencer(uint64_t until)
+	{
+		while(nextSequencerTime <= until) {
+			clockSequencer(nextSequencerTime);
+			nextSequencerTime += SEQUENCER_PERIOD;
+		}
+		lastUpdate = until;
+	}
+
+	void APU::runSquare(uint8_t index, uint64_t end)
+	{
+		SoundChannel& c = channels[index];
+		if(!c.enabled || c.period == 0) {
+			c.nextStep = end;
+			return;
+		}
+
+		uint64_t t = c.nextStep;
+		if(c.volume == 0) {
+			// Silent, so only the duty position needs to move on
+			if(t < end) {
+				if(c.level != 0)
+					setLevel(index, t, 0);
+				uint64_t steps = (end - t + c.period - 1) / c.period;
+				c.position = static_cast<uint8_t>((c.position + steps) & 7);
+				t += steps * c.period;
+			}
+		}
+		else {
+			uint8_t pattern = DUTY_PATTERNS[reg(SOUND_REGISTERS + index * 5 + NRx1) >> 6];
+			for(; t < end; t += c.period) {
+				c.position = (c.position + 1) & 7;
+				setLevel(index, t, ((pattern >> c.position) & 1) ? c.volume : 0);
+			}
+		}
+		c.nextStep = t;
+	}
+
+	void APU::runWave(uint64_t end)
+	{
+		SoundChannel& c = channels[2];
+		if(!c.enabled || c.period == 0) {
+			c.nextStep = end;
+			return;
+		}
+
+		// Volume code 0 mutes, 1-3 shift the 4 bit samples right by 0-2
+		uint8_t code = (reg(NR32) >> 5) & 0x3;
+		uint8_t shift = code == 0 ? 4 : code - 1;
+		const uint8_t* wave = &reg(WAVE_RAM);
+		uint64_t t = c.nextStep;
+		for(; t < end; t += c.period) {
+			c.position = (c.position + 1) & 31;
+			uint8_t sample = wave[c.position / 2];
+			sample = (c.position & 1) ? (sample & 0xF) : (sample >> 4);
+			setLevel(2, t, sample >> shift);
+		}
+		c.nextStep = t;
+	}
+
+	void APU::runNoise(uint64_t end)
+	{
+		SoundChannel& c = channels[3];
+		// Clock shifts of 14 and 15 stop the shift register
+		if(!c.enabled || c.period == 0) {
+			c.nextStep = end;
+			return;
+		}
+
+		bool narrow = reg(NR43) & 0x08;
+		uint64_t t = c.nextStep;
+		for(; t < end; t += c.period) {
+			uint16_t bit = (lfsr ^ (lfsr >> 1)) & 1;
+			lfsr = static_cast<uint16_t>((lfsr >> 1) | (bit << 14));
+			if(narrow)
+				lfsr = static_cast<uint16_t>((lfsr & ~0x40) | (bit << 6));
+			setLevel(3, t, (lfsr & 1) ? 0 : c.volume);
+		}
+		c.nextStep = t;
+	}
+
+	void APU::flushSamples()
+	{
+		size_t count = std::min(leftBuffer.samplesAvailable(), rightBuffer.samplesAvailable());
+		if(count == 0) return;
+		leftBuffer.readSamples(&mixBuffer[0], count, 2);
+		rightBuffer.readSamples(&mixBuffer[1], count, 2);
+		size_t written = output->write(mixBuffer.data(), count * 2);
+		droppedSamples += (count * 2 - written) / 2;
+	}
+
+	void APU::setLevel(uint8_t index, uint64_t time, uint8_t level)
+	{
+		SoundChannel& c = channels[index];
+		c.level = level;
+		if(!outputEnabled) return;
+		uint8_t nr50 = reg(NR50), nr51 = reg(NR51);
+		int32_t left = (nr51 & (0x10 << index)) ? level * (((nr50 >> 4) & 0x7) + 1) * VOLUME_UNIT : 0;
+		int32_t right = (nr51 & (0x01 << index)) ? level * ((nr50 & 0x7) + 1) * VOLUME_UNIT : 0;
+		if(left != c.left) {
+			leftBuffer.addDelta(time, left - c.left);
+			c.left = left;
+		}
+		if(right != c.right) {
+			rightBuffer.addDelta(time, right - c.right);
+			c.right = right;
+		}
+	}
+
+	void APU::remix(uint64_t time)
+	{
+		for(uint8_t i = 0; i < 4; ++i)
+			setLevel(i, time, channels[i].level);
+	}
+
+	void APU::clockSequencer(uint64_t time)
+	{
+		// Length at 256 Hz, sweep at 128 Hz and envelope at 64 Hz
+		if((sequencerStep & 1) == 0) {
+			for(uint8_t i = 0; i < 4; ++i)
+				clockLength(i, time);
+		}
+		if(sequencerStep == 2 || sequencerStep == 6)
+			clockSweep(time);
+		if(sequencerStep == 7) {
+			clockEnvelope(0);
+			clockEnvelope(1);
+			clockEnvelope(3);
+		}
+		sequencerStep = (sequencerStep + 1) & 7;
+	}
+
+	void APU::clockLength(uint8_t index, uint64_t time)
+	{
+		SoundChannel& c = channels[index];
+		if(c.lengthEnabled && c.lengthCounter > 0) {
+			if(--c.lengthCounter == 0)
+				disable(index, time);
+		}
+	}
+
+	void APU::clockEnvelope(uint8_t index)
+	{
+		SoundChannel& c = channels[index];
+		if(c.envelopePeriod == 0) return;
+		if(--c.envelopeTimer > 0) return;
+
+		c.envelopeTimer = c.envelopePeriod;
+		if(c.envelopeIncrease && c.volume < 15) ++c.volume;
+		else if(!c.envelopeIncrease && c.volume > 0) --c.volume;
+	}
+
+	void APU::clockSweep(uint64_t time)
+	{
+		if(sweepTimer == 0 || --sweepTimer > 0) return;
+
+		uint8_t nr10 = reg(NR10);
+		uint8_t sweepPeriod = (nr10 >> 4) & 0x7;
+		sweepTimer = sweepPeriod ? sweepPeriod : 8;
+		if(!sweepEnabled || sweepPeriod == 0) return;
+
+		uint16_t frequency = sweepCalculation(time);
+		if(frequency <= 2047 && (nr10 & 0x7)) {
+			sweepShadow = frequency;
+			channels[0].frequency = frequency;
+			updatePeriod(0);
+			// The new frequency is checked for overflow again, but not used
+			sweepCalculation(time);
+		}
+	}
+
+	uint16_t APU::sweepCalculation(uint64_t time)
+	{
+		uint8_t nr10 = reg(NR10);
+		uint16_t delta = sweepShadow >> (nr10 & 0x7);
+		uint16_t frequency = (nr10 & 0x08) ? sweepShadow - delta : sweepShadow + delta;
+		if(frequency > 2047)
+			disable(0, time);
+		return frequency;
+	}
+
+	void APU::trigger(uint8_t index)
+	{
+		SoundChannel& c = channels[index];
+		uint16_t base = SOUND_REGISTERS + index * 5;
+		c.enabled = c.dacEnabled;
+		if(c.lengthCounter == 0)
+			c.lengthCounter = index == 2 ? 256 : 64;
+		c.nextStep = clock + c.period;
+
+		if(index == 2) {
+			c.position = 0;
+		}
+		else {
+			uint8_t envelope = reg(base + NRx2);
+			c.volume = envelope >> 4;
+			c.envelopeIncrease = envelope & 0x08;
+			c.envelopePeriod = envelope & 0x07;
+			c.envelopeTimer = c.envelopePeriod;
+		}
+
+		if(index == 0) {
+			uint8_t nr10 = reg(NR10);
+			uint8_t sweepPeriod = (nr10 >> 4) & 0x7;
+			sweepShadow = c.frequency;
+			sweepTimer = sweepPeriod ? sweepPeriod : 8;
+			sweepEnabled = sweepPeriod || (nr10 & 0x7);
+			if(nr10 & 0x7)
+				sweepCalculation(clock);
+		}
+		else if(index == 3) {
+			lfsr = 0x7FFF;
+		}
+	}
+
+	void APU::disable(uint8_t index, uint64_t time)
+	{
+		channels[index].enabled = false;
+		setLevel(index, time, 0);
+	}
+
+	void APU::updatePeriod(uint8_t index)
+	{
+		SoundChannel& c = channels[index];
+		switch(index) {
+		case 0: case 1:
+			// 8 duty steps per waveform at 131072 / (2048 - f) Hz
+			c.period = (2048 - c.frequency) * 4;
+			break;
+		case 2:
+			// 32 samples per waveform at 65536 / (2048 - f) Hz
+			c.period = (2048 - c.frequency) * 2;
+			break;
+		case 3:
+		{
+			uint8_t nr43 = reg(NR43);
+			uint8_t shift = nr43 >> 4;
+			c.period = shift >= 14 ? 0 : static_cast<uint32_t>(NOISE_DIVISORS[nr43 & 0x7]) << shift;
+			break;
+		}
+		}
+	}
+
+	void APU::powerOff()
+	{
+		for(uint8_t i = 0; i < 4; ++i) {
+			disable(i, clock);
+			channels[i] = SoundChannel();
+		}
+		// Wave RAM is kept
+		std::fill(&registers[0], &reg(SOUND_CONTROL), 0);
+		for(uint8_t i = 0; i < 4; ++i)
+			updatePeriod(i);
+	}
+}
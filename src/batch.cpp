@@ -0,0 +1,173 @@
+#include "../include/batch.hpp"
+#include "../include/threadpool.hpp"
+#include "../include/movie.hpp"
+#include "../include/vm.hpp"
+#include "../include/vmpool.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+namespace gb_emu
+{
+	namespace
+	{
+		/**
+		 * A job while it runs. The VM only exists between its first and
+		 * last slice, so finished jobs give their memory back
+		 */
+		struct Instance {
+			const BatchJob* job;
+			VMPool* pool;
+			VMPool::Handle vm{ nullptr, VMPool::Deleter{ nullptr } };
+			std::unique_ptr<MoviePlayer> movie;
+			uint64_t target = 0;
+			BatchResult result;
+			Footprint footprint;
+		};
+
+		bool start(Instance& instance)
+		{
+			const BatchJob& job = *instance.job;
+			instance.vm = instance.pool->create(job.romPath);
+			if(!instance.vm || !instance.vm->isLoaded()) {
+				instance.result.error = "can't load " + job.romPath;
+				instance.vm.reset();
+				return false;
+			}
+			instance.target = job.frames;
+			if(!job.moviePath.empty()) {
+				instance.movie = std::make_unique<MoviePlayer>(job.moviePath);
+				if(!instance.movie->isOpen()) {
+					instance.result.error = "can't open " + job.moviePath;
+					instance.vm.reset();
+					return false;
+				}
+				if(instance.target == 0)
+					instance.target = instance.movie->getLength();
+			}
+			return true;
+		}
+
+		void finish(Instance& instance, bool ok)
+		{
+			instance.result.ok = ok;
+			instance.result.frames = instance.vm->getFrameCount();
+			instance.result.frameHash = instance.vm->getFrameHash();
+			instance.footprint = instance.vm->getFootprint();
+			instance.vm.reset();
+			instance.movie.reset();
+		}
+
+		void runSlice(Instance& instance, WorkStealingPool& pool, uint32_t sliceFrames)
+		{
+			if(!instance.vm && !start(instance)) return;
+			VM& vm = *instance.vm;
+
+			uint64_t budget = std::min<uint64_t>(sliceFrames, instance.target - vm.getFrameCount());
+			while(budget > 0) {
+				// Input only changes on the movie's records, so run up to the next one at once
+				uint64_t run = budget;
+				if(instance.movie) {
+					uint64_t frame = vm.getFrameCount();
+					vm.getJoypad().setState(instance.movie->stateFor(frame));
+					run = std::min(run, instance.movie->nextChange(frame) - frame);
+				}
+				uint64_t done = 0;
+				if(vm.runFrames(run, done) != ExecuteResult::OK) {
+					instance.result.error = "runtime error";
+					finish(instance, false);
+					return;
+				}
+				budget -= done;
+			}
+
+			if(vm.getFrameCount() < instance.target)
+				pool.submit([&instance, &pool, sliceFrames] { runSlice(instance, pool, sliceFrames); });
+			else
+				finish(instance, true);
+		}
+	}
+
+	bool readJobList(const std::string& path, std::vector<BatchJob>& jobs)
+	{
+		std::FILE* fp = std::fopen(path.c_str(), "r");
+		if(!fp) {
+			fprintf(stderr, "Can't open job list: %s\n", path.c_str());
+			return false;
+		}
+
+		bool ok = true;
+		char line[4096];
+		for(int number = 1; std::fgets(line, sizeof(line), fp); ++number) {
+			line[std::strcspn(line, "\r\n")] = '\0';
+			if(line[0] == '\0' || line[0] == '#') continue;
+
+			char* rom = std::strchr(line, '\t');
+			char* end = nullptr;
+			BatchJob job;
+			job.frames = std::strtoull(line, &end, 10);
+			if(!rom || end != rom || rom[1] == '\0') {
+				fprintf(stderr, "%s:%d: expected frames<tab>rom[<tab>movie]\n", path.c_str(), number);
+				ok = false;
+				break;
+			}
+			*rom++ = '\0';
+			char* movie = std::strchr(rom, '\t');
+			if(movie) *movie++ = '\0';
+			job.romPath = rom;
+			if(movie) job.moviePath = movie;
+			if(job.frames == 0 && job.moviePath.empty()) {
+				fprintf(stderr, "%s:%d: a job without a movie needs a frame count\n", path.c_str(), number);
+				ok = false;
+				break;
+			}
+			jobs.push_back(job);
+		}
+		std::fclose(fp);
+		return ok;
+	}
+
+	BatchRunner::BatchRunner(size_t threads, uint32_t sliceFrames, bool hugePages) :
+		threads(threads),
+		sliceFrames(std::max<uint32_t>(sliceFrames, 1)),
+		hugePages(hugePages)
+	{
+	}
+
+	BatchReport BatchRunner::run(const std::vector<BatchJob>& jobs)
+	{
+		// Room for every job at once, though only the running ones touch their slots
+		VMPool vms(jobs.size(), hugePages);
+		std::vector<Instance> instances(jobs.size());
+		for(size_t i = 0; i < jobs.size(); ++i) {
+			instances[i].job = &jobs[i];
+			instances[i].pool = &vms;
+		}
+
+		BatchReport report;
+		report.hugePages = vms.usingHugePages();
+		auto startTime = std::chrono::steady_clock::now();
+		{
+			WorkStealingPool pool(threads);
+			for(auto& instance : instances) {
+				Instance* job = &instance;
+				pool.submit([job, &pool, this] { runSlice(*job, pool, sliceFrames); });
+			}
+			pool.wait();
+			report.threads = pool.getThreadCount();
+			report.steals = pool.getSteals();
+		}
+		report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+		for(auto& instance : instances) {
+			report.totalFrames += instance.result.frames;
+			report.peakFootprint = std::max(report.peakFootprint, instance.footprint.total());
+			report.peakCaches = std::max(report.peakCaches, instance.footprint.caches);
+			report.results.push_back(std::move(instance.result));
+		}
+		return report;
+	}
+}
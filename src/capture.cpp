@@ -0,0 +1,403 @@
+#include "../include/capture.hpp"
+#include "../include/ppu.hpp"
+#include "../include/hash.hpp"
+#include <algorithm>
+#include <chrono>
+#include <climits>
+
+namespace gb_emu
+{
+	namespace
+	{
+		// Bytes buffered by stdio before each write to the OS
+		constexpr size_t WRITE_BUFFER_SIZE = 4 << 20;
+
+		inline uint8_t red(uint32_t argb) { return static_cast<uint8_t>(argb >> 16); }
+		inline uint8_t green(uint32_t argb) { return static_cast<uint8_t>(argb >> 8); }
+		inline uint8_t blue(uint32_t argb) { return static_cast<uint8_t>(argb); }
+
+		void encodeRGB(const FrameCapture::Frame& frame, uint8_t* out)
+		{
+			for(uint32_t pixel : frame) {
+				*out++ = red(pixel);
+				*out++ = green(pixel);
+				*out++ = blue(pixel);
+			}
+		}
+
+		/**
+		 * BT.601 limited range planes, Y then Cb then Cr
+		 */
+		void encodeY4M(const FrameCapture::Frame& frame, std::vector<uint8_t>& out)
+		{
+			static const char header[] = "FRAME\n";
+			constexpr size_t planeSize = SCREEN_WIDTH * SCREEN_HEIGHT;
+			out.resize(sizeof(header) - 1 + planeSize * 3);
+			std::copy(header, header + sizeof(header) - 1, out.begin());
+			uint8_t* y = &out[sizeof(header) - 1];
+			uint8_t* cb = y + planeSize;
+			uint8_t* cr = cb + planeSize;
+			for(size_t i = 0; i < planeSize; ++i) {
+				int r = red(frame[i]), g = green(frame[i]), b = blue(frame[i]);
+				y[i] = static_cast<uint8_t>(16 + ((66 * r + 129 * g + 25 * b + 128) >> 8));
+				cb[i] = static_cast<uint8_t>(128 + ((-38 * r - 74 * g + 112 * b + 128) >> 8));
+				cr[i] = static_cast<uint8_t>(128 + ((112 * r - 94 * g - 18 * b + 128) >> 8));
+			}
+		}
+
+		uint32_t crc32(const uint8_t* data, size_t length)
+		{
+			static const std::array<uint32_t, 256> table = [] {
+				std::array<uint32_t, 256> t;
+				for(uint32_t n = 0; n < 256; ++n) {
+					uint32_t c = n;
+					for(int k = 0; k < 8; ++k)
+						c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+					t[n] = c;
+				}
+				return t;
+			}();
+			uint32_t crc = 0xFFFFFFFF;
+			for(size_t i = 0; i < length; ++i)
+				crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+			return ~crc;
+		}
+
+		void putBE32(std::vector<uint8_t>& out, uint32_t v)
+		{
+			out.push_back(static_cast<uint8_t>(v >> 24));
+			out.push_back(static_cast<uint8_t>(v >> 16));
+			out.push_back(static_cast<uint8_t>(v >> 8));
+			out.push_back(static_cast<uint8_t>(v));
+		}
+
+		void putChunk(std::vector<uint8_t>& out, const char* type, const std::vector<uint8_t>& data)
+		{
+			putBE32(out, static_cast<uint32_t>(data.size()));
+			size_t start = out.size();
+			out.insert(out.end(), type, type + 4);
+			out.insert(out.end(), data.begin(), data.end());
+			putBE32(out, crc32(&out[start], out.size() - start));
+		}
+
+		// Samples moved from the APU's ring per write
+		constexpr size_t AUDIO_BLOCK_SIZE = 16384;
+		// Size of the WAV header, before the sample data
+		constexpr size_t WAV_HEADER_SIZE = 44;
+
+		void putLE(uint8_t* out, uint32_t v, int bytes)
+		{
+			for(int i = 0; i < bytes; ++i)
+				out[i] = static_cast<uint8_t>(v >> (i * 8));
+		}
+
+		/**
+		 * A canonical 16 bit stereo PCM WAV header. dataSize is filled in
+		 * again once the length is known
+		 */
+		void encodeWAVHeader(uint8_t* out, uint32_t sampleRate, uint32_t dataSize)
+		{
+			std::copy_n("RIFF", 4, out);
+			putLE(out + 4, 36 + dataSize, 4);
+			std::copy_n("WAVEfmt ", 8, out + 8);
+			putLE(out + 16, 16, 4); // fmt chunk size
+			putLE(out + 20, 1, 2); // PCM
+			putLE(out + 22, 2, 2); // Channels
+			putLE(out + 24, sampleRate, 4);
+			putLE(out + 28, sampleRate * 4, 4); // Bytes per second
+			putLE(out + 32, 4, 2); // Bytes per frame
+			putLE(out + 34, 16, 2); // Bits per sample
+			std::copy_n("data", 4, out + 36);
+			putLE(out + 40, dataSize, 4);
+		}
+
+		/**
+		 * An RGB PNG using uncompressed (stored) deflate blocks. Compression
+		 * is left to whatever post-processes the sequence, so the writer
+		 * thread stays cheap and needs no zlib
+		 */
+		void encodePNG(const FrameCapture::Frame& frame, std::vector<uint8_t>& out)
+		{
+			static const uint8_t signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+			out.assign(signature, signature + sizeof(signature));
+
+			std::vector<uint8_t> ihdr;
+			putBE32(ihdr, SCREEN_WIDTH);
+			putBE32(ihdr, SCREEN_HEIGHT);
+			ihdr.insert(ihdr.end(), { 8, 2, 0, 0, 0 }); // 8 bit RGB, no interlace
+			putChunk(out, "IHDR", ihdr);
+
+			// Each row is a filter type byte (0 = none) then the pixels
+			constexpr size_t rowSize = 1 + SCREEN_WIDTH * 3;
+			std::vector<uint8_t> raw(rowSize * SCREEN_HEIGHT);
+			for(size_t y = 0; y < SCREEN_HEIGHT; ++y) {
+				raw[y * rowSize] = 0;
+				uint8_t* dst = &raw[y * rowSize + 1];
+				for(size_t x = 0; x < SCREEN_WIDTH; ++x) {
+					uint32_t pixel = frame[y * SCREEN_WIDTH + x];
+					*dst++ = red(pixel);
+					*dst++ = green(pixel);
+					*dst++ = blue(pixel);
+				}
+			}
+
+			std::vector<uint8_t> idat = { 0x78, 0x01 }; // zlib header, no compression
+			uint32_t adlerA = 1, adlerB = 0;
+			for(size_t pos = 0; pos < raw.size();) {
+				size_t length = std::min<size_t>(raw.size() - pos, 0xFFFF);
+				bool last = pos + length == raw.size();
+				idat.push_back(last ? 1 : 0);
+				idat.push_back(static_cast<uint8_t>(length));
+				idat.push_back(static_cast<uint8_t>(length >> 8));
+				idat.push_back(static_cast<uint8_t>(~length));
+				idat.push_back(static_cast<uint8_t>(~length >> 8));
+				idat.insert(idat.end(), raw.begin() + pos, raw.begin() + pos + length);
+				for(size_t i = pos; i < pos + length; ++i) {
+					adlerA = (adlerA + raw[i]) % 65521;
+					adlerB = (adlerB + adlerA) % 65521;
+				}
+				pos += length;
+			}
+			putBE32(idat, (adlerB << 16) | adlerA);
+			putChunk(out, "IDAT", idat);
+			putChunk(out, "IEND", {});
+		}
+	}
+
+	FrameCapture::FrameCapture(const std::string& path, CaptureFormat format, size_t queueFrames)
+		: path(path), format(format), slots(queueFrames), freeSlots(queueFrames), readySlots(queueFrames + 1)
+	{
+		if(format != CaptureFormat::PNG_SEQUENCE) {
+			out = std::fopen(path.c_str(), "wb");
+			if(!out) {
+				fprintf(stderr, "Failed to open capture file: %s\n", path.c_str());
+				return;
+			}
+			outBuffer.resize(WRITE_BUFFER_SIZE);
+			std::setvbuf(out, outBuffer.data(), _IOFBF, outBuffer.size());
+
+			if(format == CaptureFormat::Y4M) {
+				// Frame rate is the exact DMG refresh rate, clock speed / cycles per frame
+				fprintf(out, "YUV4MPEG2 W%zu H%zu F%u:%u Ip A1:1 C444\n", SCREEN_WIDTH, SCREEN_HEIGHT,
+					CLOCK_SPEED, PPU::CYCLES_PER_FRAME);
+			}
+		}
+
+		for(uint16_t i = 0; i < queueFrames; ++i)
+			freeSlots.push(i);
+		open = true;
+		worker = std::thread(&FrameCapture::run, this);
+	}
+
+	FrameCapture::~FrameCapture()
+	{
+		if(worker.joinable()) {
+			stopping.store(true, std::memory_order_release);
+			wake.notify_one();
+			worker.join();
+		}
+		if(out) std::fclose(out);
+	}
+
+	void FrameCapture::submit(const uint32_t* frame)
+	{
+		if(!open) return;
+		uint16_t slot;
+		lastDropped = !freeSlots.pop(slot);
+		if(lastDropped) {
+			droppedFrames.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		std::copy(frame, frame + slots[slot].size(), slots[slot].begin());
+		hand(slot);
+	}
+
+	void FrameCapture::submitRepeat(const uint32_t* frame)
+	{
+		if(!open) return;
+		// The writer's last frame is the one before the dropped frame, not a copy of this one
+		if(lastDropped)
+			submit(frame);
+		else
+			hand(REPEAT_SLOT);
+	}
+
+	void FrameCapture::hand(uint16_t slot)
+	{
+		if(!readySlots.push(slot)) {
+			// Only possible for repeats, as real slots can't outnumber the queue
+			droppedFrames.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		wake.notify_one();
+	}
+
+	void FrameCapture::run()
+	{
+		for(;;) {
+			uint16_t slot;
+			if(readySlots.pop(slot)) {
+				bool written;
+				if(slot == REPEAT_SLOT) {
+					written = writeEncoded();
+				}
+				else {
+					written = writeFrame(slots[slot]);
+					freeSlots.push(slot);
+				}
+				if(written)
+					writtenFrames.fetch_add(1, std::memory_order_relaxed);
+				continue;
+			}
+			if(stopping.load(std::memory_order_acquire)) {
+				// Drain anything handed over after the last check before exiting
+				if(readySlots.size() == 0) break;
+				continue;
+			}
+			// Notifications aren't made under the lock, so wait with a timeout
+			// rather than risk sleeping through one
+			if(out) std::fflush(out);
+			std::unique_lock<std::mutex> lock(wakeMutex);
+			wake.wait_for(lock, std::chrono::milliseconds(10));
+		}
+		if(out) std::fflush(out);
+	}
+
+	bool FrameCapture::writeFrame(const Frame& frame)
+	{
+		switch(format) {
+		case CaptureFormat::Y4M:
+			encodeY4M(frame, encoded);
+			break;
+		case CaptureFormat::RAW_RGB:
+			encoded.resize(frame.size() * 3);
+			encodeRGB(frame, encoded.data());
+			break;
+		case CaptureFormat::PNG_SEQUENCE:
+			encodePNG(frame, encoded);
+			break;
+		}
+		haveEncoded = true;
+		return writeEncoded();
+	}
+
+	bool FrameCapture::writeEncoded()
+	{
+		if(!haveEncoded) return false;
+		if(format == CaptureFormat::PNG_SEQUENCE) {
+			char name[32];
+			snprintf(name, sizeof(name), "_%06llu.png", static_cast<unsigned long long>(writtenFrames.load(std::memory_order_relaxed)));
+			std::FILE* fp = std::fopen((path + name).c_str(), "wb");
+			if(!fp) {
+				fprintf(stderr, "Failed to write %s%s\n", path.c_str(), name);
+				return false;
+			}
+			bool ok = std::fwrite(encoded.data(), 1, encoded.size(), fp) == encoded.size();
+			return std::fclose(fp) == 0 && ok;
+		}
+		return std::fwrite(encoded.data(), 1, encoded.size(), out) == encoded.size();
+	}
+
+	AudioCapture::AudioCapture(const std::string& path, AudioFormat format, RingBuffer<int16_t>& input, uint32_t sampleRate)
+		: format(format), input(input), block(AUDIO_BLOCK_SIZE)
+	{
+		out = std::fopen(path.c_str(), "wb");
+		if(!out) {
+			fprintf(stderr, "Failed to open audio capture file: %s\n", path.c_str());
+			return;
+		}
+		outBuffer.resize(WRITE_BUFFER_SIZE);
+		std::setvbuf(out, outBuffer.data(), _IOFBF, outBuffer.size());
+
+		if(format == AudioFormat::WAV) {
+			// Sizes are patched in by finishFile. WAV is little endian, as are the hosts we build for
+			uint8_t header[WAV_HEADER_SIZE];
+			encodeWAVHeader(header, sampleRate, 0);
+			std::fwrite(header, 1, sizeof(header), out);
+		}
+
+		open = true;
+		worker = std::thread(&AudioCapture::run, this);
+	}
+
+	AudioCapture::~AudioCapture()
+	{
+		close();
+	}
+
+	void AudioCapture::close()
+	{
+		if(worker.joinable()) {
+			stopping.store(true, std::memory_order_release);
+			worker.join();
+		}
+		if(out) {
+			finishFile();
+			std::fclose(out);
+			out = nullptr;
+		}
+	}
+
+	void AudioCapture::throttle()
+	{
+		while(open && input.size() > input.capacity() / 2)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	void AudioCapture::run()
+	{
+		for(;;) {
+			// Read stopping first, so nothing pushed before close is missed
+			bool last = stopping.load(std::memory_order_acquire);
+			size_t count = input.read(block.data(), block.size());
+			if(count > 0) {
+				write(block.data(), count);
+				continue;
+			}
+			if(last) break;
+			// The ring holds a quarter of a second, so polling is plenty
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		}
+		std::fflush(out);
+	}
+
+	void AudioCapture::write(const int16_t* samples, size_t count)
+	{
+		std::fwrite(samples, sizeof(int16_t), count, out);
+		writtenSamples.fetch_add(count, std::memory_order_relaxed);
+
+		// Hash whole chunks, chaining each into the next's seed
+		while(count > 0) {
+			size_t take = std::min(count, CHECKSUM_CHUNK - pending.size());
+			pending.insert(pending.end(), samples, samples + take);
+			samples += take;
+			count -= take;
+			if(pending.size() == CHECKSUM_CHUNK) {
+				checksum = hashBytes(pending.data(), pending.size() * sizeof(int16_t), checksum);
+				pending.clear();
+			}
+		}
+	}
+
+	void AudioCapture::finishFile()
+	{
+		if(!pending.empty()) {
+			checksum = hashBytes(pending.data(), pending.size() * sizeof(int16_t), checksum);
+			pending.clear();
+		}
+		if(format != AudioFormat::WAV) return;
+
+		uint64_t dataSize = writtenSamples.load(std::memory_order_relaxed) * sizeof(int16_t);
+		if(dataSize > UINT32_MAX - 36) {
+			fprintf(stderr, "Audio capture is too long for a WAV header, sizes left unset\n");
+			return;
+		}
+		uint8_t header[WAV_HEADER_SIZE];
+		encodeWAVHeader(header, 0, static_cast<uint32_t>(dataSize));
+		// Only the two sizes are rewritten, so the rate passed above doesn't matter
+		std::fseek(out, 4, SEEK_SET);
+		std::fwrite(header + 4, 1, 4, out);
+		std::fseek(out, 40, SEEK_SET);
+		std::fwrite(header + 40, 1, 4, out);
+	}
+}
@@ -0,0 +1,55 @@
+#include "../include/joypad.hpp"
+#include "../include/mem.hpp"
+#include "../include/reservedAddresses.hpp"
+
+namespace gb_emu
+{
+	namespace
+	{
+		constexpr uint8_t JOYPAD_INTERRUPT = 0x10;
+		constexpr uint8_t SELECT_DIRECTIONS = 0x10;
+		constexpr uint8_t SELECT_BUTTONS = 0x20;
+	}
+
+	Joypad::Joypad(MMU& mem) : mem(mem)
+	{
+	}
+
+	void Joypad::saveState(State& state) const
+	{
+		state = { pressed, select };
+	}
+
+	void Joypad::loadState(const State& state)
+	{
+		pressed = state.pressed;
+		select = state.select;
+	}
+
+	uint8_t Joypad::lines(uint8_t state) const
+	{
+		uint8_t low = 0;
+		if(!(select & SELECT_DIRECTIONS)) low |= state & 0x0F;
+		if(!(select & SELECT_BUTTONS)) low |= state >> 4;
+		return static_cast<uint8_t>(~low & 0x0F);
+	}
+
+	void Joypad::setState(uint8_t state)
+	{
+		// Any selected line falling from 1 to 0 raises the interrupt
+		if(lines(pressed) & ~lines(state))
+			mem.setIORegister(INTERRUPT_FLAG, mem.getIORegister(INTERRUPT_FLAG) | JOYPAD_INTERRUPT);
+		pressed = state;
+	}
+
+	uint8_t Joypad::readIO(uint16_t)
+	{
+		// The top two bits aren't connected and read as 1
+		return 0xC0 | select | lines(pressed);
+	}
+
+	void Joypad::writeIO(uint16_t, uint8_t value)
+	{
+		select = value & (SELECT_DIRECTIONS | SELECT_BUTTONS);
+	}
+}
@@ -1,34 +1,76 @@
 #include "..\include\lcd.hpp"
+#include <cstdio>
+#include <cstring>
 
 namespace gb_emu
 {
-	LCD::LCD()
+	LCD::LCD(const char* renderDriver, int scale)
 	{
-		window = SDL_CreateWindow("GB_EMU", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 640, 480, 0);
+		window = SDL_CreateWindow("GB_EMU", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+			static_cast<int>(SCREEN_WIDTH) * scale, static_cast<int>(SCREEN_HEIGHT) * scale, SDL_WINDOW_RESIZABLE);
+		if(!window) {
+			fprintf(stderr, "Failed to create window: %s\n", SDL_GetError());
+			return;
+		}
+
+		// The hint is the only way to pick a backend by name. "software" still
+		// needs the flag, as SDL otherwise prefers an accelerated renderer
+		Uint32 flags = 0;
+		if(renderDriver) {
+			SDL_SetHint(SDL_HINT_RENDER_DRIVER, renderDriver);
+			if(std::strcmp(renderDriver, "software") == 0)
+				flags = SDL_RENDERER_SOFTWARE;
+		}
+		renderer = SDL_CreateRenderer(window, -1, flags);
+		if(!renderer) {
+			fprintf(stderr, "Failed to create renderer: %s\n", SDL_GetError());
+			return;
+		}
 
-		renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_SOFTWARE);
-		SDL_SetRenderDrawColor(renderer, 128, 0, 0, SDL_ALPHA_OPAQUE);
+		// Nearest neighbour scaling, and letterbox when the window aspect doesn't match
+		SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "nearest");
+		SDL_RenderSetLogicalSize(renderer, static_cast<int>(SCREEN_WIDTH), static_cast<int>(SCREEN_HEIGHT));
+		texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+			static_cast<int>(SCREEN_WIDTH), static_cast<int>(SCREEN_HEIGHT));
+		if(!texture) {
+			fprintf(stderr, "Failed to create texture: %s\n", SDL_GetError());
+			return;
+		}
+		SDL_SetRenderDrawColor(renderer, 0, 0, 0, SDL_ALPHA_OPAQUE);
 	}
 
 	LCD::~LCD()
 	{
-		SDL_DestroyWindow(window);
+		if(texture) SDL_DestroyTexture(texture);
+		if(renderer) SDL_DestroyRenderer(renderer);
+		if(window) SDL_DestroyWindow(window);
 	}
 
-	void LCD::setColour(uint32_t r, uint32_t g, uint32_t b)
+	void LCD::present(const uint32_t* frame)
 	{
-		// Set colours
-
-		// Increment pixel position
-		++currX;
+		if(!texture) return;
 
-		if(currX > 160) {
-			// Fire hblank interrupt?
+		void* pixels;
+		int pitch;
+		if(SDL_LockTexture(texture, nullptr, &pixels, &pitch) != 0) {
+			fprintf(stderr, "Failed to lock texture: %s\n", SDL_GetError());
+			return;
 		}
-		if(currY > 144) {
-			// Fire vblank interrupt?
-			SDL_RenderClear(renderer);
-			SDL_RenderPresent(renderer);
+		// The texture rows may be padded, so only copy in one go when they aren't
+		constexpr size_t rowBytes = SCREEN_WIDTH * sizeof(uint32_t);
+		if(static_cast<size_t>(pitch) == rowBytes) {
+			std::memcpy(pixels, frame, rowBytes * SCREEN_HEIGHT);
 		}
+		else {
+			uint8_t* dst = static_cast<uint8_t*>(pixels);
+			for(size_t y = 0; y < SCREEN_HEIGHT; ++y) {
+				std::memcpy(dst + y * pitch, frame + y * SCREEN_WIDTH, rowBytes);
+			}
+		}
+		SDL_UnlockTexture(texture);
+
+		SDL_RenderClear(renderer);
+		SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+		SDL_RenderPresent(renderer);
 	}
 }
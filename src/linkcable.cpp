@@ -0,0 +1,178 @@
+#include "../include/linkcable.hpp"
+#include "../include/serial.hpp"
+#include "../include/vm.hpp"
+#include <algorithm>
+#include <thread>
+
+namespace gb_emu
+{
+	namespace
+	{
+		constexpr uint8_t SERIAL_INTERRUPT = 0x08;
+		constexpr uint8_t TRANSFER_START = 0x80;
+
+		// A byte takes a whole transfer to arrive, so neither side may get further ahead than that
+		constexpr uint64_t WINDOW = Serial::TRANSFER_CYCLES;
+	}
+
+	LinkCable::LinkCable(VM& a, VM& b) :
+		vms{ &a, &b }
+	{
+		for(int side = 0; side < 2; ++side) {
+			End& end = ends[side];
+			end.serial = &vms[side]->getSerial();
+			end.base = end.serial->clock;
+			end.horizon = WINDOW;
+			end.pending.reserve(4);
+			end.serial->cable = this;
+			end.serial->side = side;
+		}
+		for(int side = 0; side < 2; ++side) {
+			// A transfer already under way starts over on the cable
+			if(ends[side].serial->transferEnd != Serial::NEVER)
+				start(side);
+			schedule(side);
+		}
+	}
+
+	LinkCable::~LinkCable()
+	{
+		for(int side = 0; side < 2; ++side)
+			leave(side);
+	}
+
+	ExecuteResult LinkCable::run(uint64_t frames)
+	{
+		ExecuteResult results[2] = { ExecuteResult::OK, ExecuteResult::OK };
+		auto runSide = [this, frames, &results](int side) {
+			uint64_t done = 0;
+			results[side] = vms[side]->runFrames(frames, done);
+			leave(side);
+		};
+		std::thread other(runSide, 1);
+		runSide(0);
+		other.join();
+		return results[0] != ExecuteResult::OK ? results[0] : results[1];
+	}
+
+	void LinkCable::leave(VM& vm)
+	{
+		leave(vms[0] == &vm ? 0 : 1);
+	}
+
+	void LinkCable::leave(int side)
+	{
+		End& end = ends[side];
+		if(!end.serial) return;
+		end.clock.store(GONE, std::memory_order_release);
+		Serial& serial = *end.serial;
+		end.serial = nullptr;
+		serial.cable = nullptr;
+		serial.schedule();
+	}
+
+	uint64_t LinkCable::now(int side) const
+	{
+		return ends[side].serial->clock - ends[side].base;
+	}
+
+	void LinkCable::send(int side, const Message& message)
+	{
+		// The receiver drains its inbox whenever it syncs, so this only waits if it is far behind
+		End& other = ends[side ^ 1];
+		while(!other.inbox.push(message)) {
+			if(other.clock.load(std::memory_order_acquire) == GONE) return;
+			std::this_thread::yield();
+		}
+	}
+
+	void LinkCable::receive(int side)
+	{
+		End& end = ends[side];
+		Message message;
+		while(end.inbox.pop(message)) {
+			if(message.reply) end.replied = true;
+			auto at = std::upper_bound(end.pending.begin(), end.pending.end(), message,
+				[](const Message& a, const Message& b) { return a.time < b.time; });
+			end.pending.insert(at, message);
+		}
+	}
+
+	void LinkCable::apply(int side, const Message& message)
+	{
+		Serial& serial = *ends[side].serial;
+		if(message.reply) {
+			// Unless the program has cancelled the transfer since
+			if(serial.transferEnd != Serial::NEVER)
+				serial.finish(message.byte);
+			return;
+		}
+		// Both sides clocking transfers which overlap. The other side started
+		// one transfer before message.time, so this is symmetric
+		End& end = ends[side];
+		if(end.started != GONE && end.started + Serial::TRANSFER_CYCLES > message.time - Serial::TRANSFER_CYCLES
+			&& end.started < message.time) {
+			send(side, { now(side), 0xFF, true });
+			return;
+		}
+		// The other side clocked a transfer: swap bytes whether or not this side was ready for it
+		send(side, { now(side), serial.data, true });
+		serial.data = message.byte;
+		if((serial.control & TRANSFER_START) && !serial.internalClock()) {
+			serial.control &= ~TRANSFER_START;
+			serial.mem.setIORegister(INTERRUPT_FLAG, serial.mem.getIORegister(INTERRUPT_FLAG) | SERIAL_INTERRUPT);
+		}
+	}
+
+	void LinkCable::start(int side)
+	{
+		End& end = ends[side];
+		end.replied = false;
+		end.started = now(side);
+		send(side, { now(side) + Serial::TRANSFER_CYCLES, end.serial->data, false });
+	}
+
+	void LinkCable::sync(int side)
+	{
+		End& end = ends[side];
+		End& other = ends[side ^ 1];
+		Serial& serial = *end.serial;
+		uint64_t time = now(side);
+		for(;;) {
+			end.clock.store(time, std::memory_order_release);
+			// Before receiving, so everything sent before the other side got this far is seen
+			uint64_t otherClock = other.clock.load(std::memory_order_acquire);
+			receive(side);
+			while(!end.pending.empty() && end.pending.front().time <= time) {
+				Message message = end.pending.front();
+				end.pending.erase(end.pending.begin());
+				apply(side, message);
+			}
+
+			bool awaitingReply = serial.transferEnd <= serial.clock && !end.replied;
+			if(otherClock == GONE) {
+				// Everything it sent has been received, so no reply is coming
+				if(awaitingReply)
+					serial.finish(0xFF);
+				end.horizon = GONE;
+				break;
+			}
+			end.horizon = otherClock + WINDOW;
+			if(!awaitingReply && time < end.horizon) break;
+			std::this_thread::yield();
+		}
+		schedule(side);
+	}
+
+	void LinkCable::schedule(int side)
+	{
+		End& end = ends[side];
+		Serial& serial = *end.serial;
+		uint64_t next = end.horizon;
+		if(!end.pending.empty())
+			next = std::min(next, end.pending.front().time);
+		if(serial.transferEnd != Serial::NEVER && !end.replied)
+			next = std::min(next, serial.transferEnd - end.base);
+		serial.nextEvent = next == GONE ? Serial::NEVER : next + end.base;
+	}
+}
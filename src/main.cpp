@@ -1,13 +1,670 @@
 #include "../include/vm.hpp"
+#include "../include/lcd.hpp"
+#include "../include/capture.hpp"
+#include "../include/resampler.hpp"
+#include "../include/movie.hpp"
+#include "../include/rewind.hpp"
+#include "../include/batch.hpp"
+#include "../include/runtimestats.hpp"
+#include <memory>
 #include <SDL.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+	constexpr const char* DEFAULT_ROM = "Tetris (W) (V1.0) [!].gb";
+	// One minute of emulated time
+	constexpr uint64_t DEFAULT_BENCH_FRAMES = 3600;
+
+	/**
+	 * What the audio callback needs: the APU's output, and the resampler
+	 * which converts it to the device's rate
+	 */
+	struct AudioOutput {
+		gb_emu::RingBuffer<int16_t>& ring;
+		// Created once the device's rate is known
+		std::unique_ptr<gb_emu::Resampler> resampler;
+		// Sized along with the resampler for the largest block the callback
+		// can need, so the audio thread never allocates
+		std::vector<int16_t> input;
+		gb_emu::StatsMonitor& stats;
+	};
+
+	/**
+	 * Closes a stdio file when it goes out of scope, so early returns
+	 * don't leave output unflushed
+	 */
+	struct FileCloser {
+		void operator()(std::FILE* fp) const { std::fclose(fp); }
+	};
+	using FilePtr = std::unique_ptr<std::FILE, FileCloser>;
+
+	/**
+	 * Shuts SDL down when it goes out of scope, however the run ends
+	 */
+	struct SDLSession {
+		~SDLSession() { SDL_Quit(); }
+	};
+
+	/**
+	 * Drains the APU's ring buffer on SDL's audio thread, padding with
+	 * silence if the emulator has fallen behind. The resampler's rate is
+	 * nudged to keep the ring near the level the APU refills it to, so the
+	 * audio device's clock doesn't drift away from the emulator's
+	 */
+	void audioCallback(void* userdata, Uint8* stream, int length)
+	{
+		auto* audio = static_cast<AudioOutput*>(userdata);
+		int16_t* samples = reinterpret_cast<int16_t*>(stream);
+		size_t frames = static_cast<size_t>(length) / (2 * sizeof(int16_t));
+
+		audio->resampler->updateRate(audio->ring.size() / 2, gb_emu::APU::SAMPLE_RATE / 40);
+		size_t needed = std::min(audio->resampler->inputFramesNeeded(frames), audio->input.size() / 2);
+		size_t read = audio->ring.read(audio->input.data(), needed * 2) / 2;
+		audio->resampler->write(audio->input.data(), read);
+
+		size_t written = audio->resampler->read(samples, frames);
+		std::fill(samples + written * 2, samples + frames * 2, 0);
+		if(written < frames)
+			audio->stats.countAudioUnderrun();
+	}
+
+	/**
+	 * The joypad bit for a key, or 0 if the key isn't mapped
+	 */
+	uint8_t buttonForKey(SDL_Keycode key)
+	{
+		switch(key) {
+		case SDLK_RIGHT: return gb_emu::toUType(gb_emu::Button::RIGHT);
+		case SDLK_LEFT: return gb_emu::toUType(gb_emu::Button::LEFT);
+		case SDLK_UP: return gb_emu::toUType(gb_emu::Button::UP);
+		case SDLK_DOWN: return gb_emu::toUType(gb_emu::Button::DOWN);
+		case SDLK_z: return gb_emu::toUType(gb_emu::Button::A);
+		case SDLK_x: return gb_emu::toUType(gb_emu::Button::B);
+		case SDLK_BACKSPACE:
+		case SDLK_RSHIFT: return gb_emu::toUType(gb_emu::Button::SELECT);
+		case SDLK_RETURN: return gb_emu::toUType(gb_emu::Button::START);
+		}
+		return 0;
+	}
+
+	/**
+	 * Runs romPath for frames frames as fast as it will go, with input from
+	 * the movie at playPath if given, and prints how fast that was. frames
+	 * of 0 means the movie's length
+	 */
+	int runBenchmark(const char* romPath, uint64_t frames, const char* playPath, const char* opcodeStatsPath,
+		gb_emu::Profiler* profiler, const char* profilePath, const char* tracePath, size_t traceSize, std::FILE* statsJSON)
+	{
+		auto vm = std::make_unique<gb_emu::VM>(romPath);
+		if(!vm->isLoaded())
+			return EXIT_FAILURE;
+		vm->setProfiler(profiler);
+		if(tracePath)
+			vm->enableTrace(traceSize);
+		std::unique_ptr<gb_emu::MoviePlayer> player;
+		if(playPath) {
+			player = std::make_unique<gb_emu::MoviePlayer>(playPath);
+			if(!player->isOpen())
+				return EXIT_FAILURE;
+			if(frames == 0) frames = player->getLength();
+		}
+		if(frames == 0) frames = DEFAULT_BENCH_FRAMES;
+
+		// Only published at the end, so the percentiles cover the whole run
+		gb_emu::StatsMonitor stats(std::chrono::hours(24));
+		auto start = std::chrono::steady_clock::now();
+		while(vm->getFrameCount() < frames) {
+			stats.beginFrame();
+			if(player) {
+				uint64_t frame = vm->getFrameCount();
+				vm->getJoypad().setState(player->stateFor(frame));
+			}
+			if(vm->runFrame() != gb_emu::ExecuteResult::OK) {
+				fprintf(stderr, "Instruction returned RUNTIME_ERROR at frame %llu\n",
+					static_cast<unsigned long long>(vm->getFrameCount()));
+				if(tracePath)
+					vm->dumpTrace(tracePath);
+				return EXIT_FAILURE;
+			}
+			stats.endFrame(*vm);
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		double framesPerSecond = frames / seconds;
+		double realTimeFPS = static_cast<double>(gb_emu::CLOCK_SPEED) / gb_emu::PPU::CYCLES_PER_FRAME;
+		uint64_t instructions = vm->getInstructionCount();
+		printf("rom                 %s\n", romPath);
+		printf("movie               %s\n", playPath ? playPath : "none");
+		printf("frames              %llu\n", static_cast<unsigned long long>(frames));
+		printf("wall time           %.3f s\n", seconds);
+		printf("emulated fps        %.1f\n", framesPerSecond);
+		printf("speed               %.2fx real time\n", framesPerSecond / realTimeFPS);
+		printf("instructions        %llu\n", static_cast<unsigned long long>(instructions));
+		printf("mips                %.2f\n", instructions / seconds / 1e6);
+		printf("ns per frame        %.0f\n", seconds * 1e9 / frames);
+		stats.publish(*vm);
+		gb_emu::RuntimeStats snapshot = stats.read();
+		printf("frame time p50      %llu ns\n", static_cast<unsigned long long>(snapshot.frameTimeP50));
+		printf("frame time p99      %llu ns\n", static_cast<unsigned long long>(snapshot.frameTimeP99));
+		printf("bank switches       %llu\n", static_cast<unsigned long long>(snapshot.bankSwitches));
+		if(statsJSON)
+			gb_emu::writeStatsJSON(statsJSON, snapshot);
+		printf("final frame hash    %016llx\n", static_cast<unsigned long long>(vm->getFrameHash()));
+		if(profiler)
+			printf("profile samples     %llu\n", static_cast<unsigned long long>(profiler->getSampleCount()));
+		if(opcodeStatsPath && !vm->getOpcodeStats().writeReport(opcodeStatsPath))
+			return EXIT_FAILURE;
+		if(profiler && !profiler->writeFolded(profilePath))
+			return EXIT_FAILURE;
+		return 0;
+	}
+
+	void printUsage(const char* exe)
+	{
+		fprintf(stderr,
+			"Usage: %s [options]\n"
+			"  --rom <path>           Cartridge to run (default %s)\n"
+			"  --frames <n>           Stop after n frames\n"
+			"  --bench                Run --frames frames (default %llu, or the movie\n"
+			"                         from --play) with no window, audio or pacing,\n"
+			"                         then print emulated fps, MIPS and time per frame\n"
+			"  --renderer <name>      SDL render driver (software, opengl, direct3d, ...)\n"
+			"  --video-driver <name>  SDL video driver (e.g. dummy, offscreen for CI)\n"
+			"  --scale <n>            Initial window scale (default 4)\n"
+			"  --no-audio             Don't open an audio device\n"
+			"  --frame-hashes <path>  Write each frame's hash to a file, one per line\n"
+			"  --capture <path>       Record frames to a file (or file prefix for png)\n"
+			"  --capture-format <f>   y4m (default), rgb or png\n"
+			"  --audio-capture <path> Record audio to a file instead of playing it\n"
+			"  --audio-format <f>     wav (default) or pcm\n"
+			"  --record <path>        Record joypad input to a movie\n"
+			"  --play <path>          Play joypad input back from a movie\n"
+			"  --state <path>         Save-state file for F5 (save) and F9 (load), and\n"
+			"                         loaded at start if it exists. Not with movies\n"
+			"  --rewind <seconds>     Keep this much play to rewind through, by holding R\n"
+			"  --rewind-memory <MB>   Memory cap for rewind (default 64)\n"
+			"  --headless             No window, audio device or frame pacing. Stops\n"
+			"                         after --frames, or when the movie from --play ends\n"
+			"  --batch <path>         Run every job in a job list (lines of\n"
+			"                         frames<tab>rom[<tab>movie]) without a window, and\n"
+			"                         print each one's final frame hash\n"
+			"  --threads <n>          Worker threads for --batch (default one per core)\n"
+			"  --huge-pages           Allocate --batch VMs on huge pages where possible\n"
+			"  --opcode-stats <path>  Write per-opcode execution and cycle counts on exit\n"
+			"                         (needs a build with GB_EMU_OPCODE_STATS)\n"
+			"  --profile <path>       Sample the emulated PC and call stack, and write\n"
+			"                         folded stacks (for flamegraph.pl) on exit\n"
+			"  --profile-interval <n> Emulated cycles between samples (default %u)\n"
+			"  --symbols <path>       Name --profile's routines from an RGBDS .sym file\n"
+			"  --trace <path>         Keep a ring of the last instructions run, and write\n"
+			"                         it here on a RUNTIME_ERROR or when F12 is pressed.\n"
+			"                         gb_trace decodes it\n"
+			"  --trace-size <n>       Instructions the ring holds (default %zu)\n"
+			"  --stats                Print frame times, rates and counters to stderr\n"
+			"                         every second\n"
+			"  --stats-json <path>    Append the same as a JSON object per line\n",
+			exe, DEFAULT_ROM, static_cast<unsigned long long>(DEFAULT_BENCH_FRAMES), gb_emu::Profiler::DEFAULT_INTERVAL,
+			gb_emu::TraceRing::DEFAULT_CAPACITY);
+	}
+}
 
 int main(int argc, char *args[])
 {
-	SDL_Init(SDL_INIT_VIDEO);
+	const char* romPath = DEFAULT_ROM;
+	uint64_t frameLimit = 0;
+	bool bench = false;
+	const char* renderDriver = nullptr;
+	const char* videoDriver = nullptr;
+	int scale = 4;
+	bool audio = true;
+	const char* hashPath = nullptr;
+	const char* capturePath = nullptr;
+	gb_emu::CaptureFormat captureFormat = gb_emu::CaptureFormat::Y4M;
+	const char* audioCapturePath = nullptr;
+	gb_emu::AudioFormat audioFormat = gb_emu::AudioFormat::WAV;
+	const char* recordPath = nullptr;
+	const char* playPath = nullptr;
+	bool headless = false;
+	const char* statePath = nullptr;
+	int rewindSeconds = 0;
+	size_t rewindMemory = 64;
+	const char* batchPath = nullptr;
+	size_t threads = 0;
+	bool hugePages = false;
+	const char* opcodeStatsPath = nullptr;
+	const char* profilePath = nullptr;
+	uint32_t profileInterval = gb_emu::Profiler::DEFAULT_INTERVAL;
+	const char* symbolsPath = nullptr;
+	const char* tracePath = nullptr;
+	size_t traceSize = gb_emu::TraceRing::DEFAULT_CAPACITY;
+	bool printStats = false;
+	const char* statsJSONPath = nullptr;
+	for(int i = 1; i < argc; ++i) {
+		bool hasValue = i + 1 < argc;
+		if(std::strcmp(args[i], "--rom") == 0 && hasValue) {
+			romPath = args[++i];
+		}
+		else if(std::strcmp(args[i], "--frames") == 0 && hasValue) {
+			frameLimit = std::strtoull(args[++i], nullptr, 10);
+		}
+		else if(std::strcmp(args[i], "--bench") == 0) {
+			bench = true;
+		}
+		else if(std::strcmp(args[i], "--renderer") == 0 && hasValue) {
+			renderDriver = args[++i];
+		}
+		else if(std::strcmp(args[i], "--video-driver") == 0 && hasValue) {
+			videoDriver = args[++i];
+		}
+		else if(std::strcmp(args[i], "--scale") == 0 && hasValue) {
+			scale = std::atoi(args[++i]);
+			if(scale < 1) scale = 1;
+		}
+		else if(std::strcmp(args[i], "--no-audio") == 0) {
+			audio = false;
+		}
+		else if(std::strcmp(args[i], "--frame-hashes") == 0 && hasValue) {
+			hashPath = args[++i];
+		}
+		else if(std::strcmp(args[i], "--capture") == 0 && hasValue) {
+			capturePath = args[++i];
+		}
+		else if(std::strcmp(args[i], "--capture-format") == 0 && hasValue) {
+			const char* format = args[++i];
+			if(std::strcmp(format, "y4m") == 0)
+				captureFormat = gb_emu::CaptureFormat::Y4M;
+			else if(std::strcmp(format, "rgb") == 0)
+				captureFormat = gb_emu::CaptureFormat::RAW_RGB;
+			else if(std::strcmp(format, "png") == 0)
+				captureFormat = gb_emu::CaptureFormat::PNG_SEQUENCE;
+			else {
+				printUsage(args[0]);
+				return EXIT_FAILURE;
+			}
+		}
+		else if(std::strcmp(args[i], "--audio-capture") == 0 && hasValue) {
+			audioCapturePath = args[++i];
+		}
+		else if(std::strcmp(args[i], "--audio-format") == 0 && hasValue) {
+			const char* format = args[++i];
+			if(std::strcmp(format, "wav") == 0)
+				audioFormat = gb_emu::AudioFormat::WAV;
+			else if(std::strcmp(format, "pcm") == 0)
+				audioFormat = gb_emu::AudioFormat::RAW_PCM;
+			else {
+				printUsage(args[0]);
+				return EXIT_FAILURE;
+			}
+		}
+		else if(std::strcmp(args[i], "--record") == 0 && hasValue) {
+			recordPath = args[++i];
+		}
+		else if(std::strcmp(args[i], "--play") == 0 && hasValue) {
+			playPath = args[++i];
+		}
+		else if(std::strcmp(args[i], "--state") == 0 && hasValue) {
+			statePath = args[++i];
+		}
+		else if(std::strcmp(args[i], "--rewind") == 0 && hasValue) {
+			rewindSeconds = std::max(std::atoi(args[++i]), 0);
+		}
+		else if(std::strcmp(args[i], "--rewind-memory") == 0 && hasValue) {
+			rewindMemory = static_cast<size_t>(std::max(std::atoi(args[++i]), 1));
+		}
+		else if(std::strcmp(args[i], "--headless") == 0) {
+			headless = true;
+		}
+		else if(std::strcmp(args[i], "--batch") == 0 && hasValue) {
+			batchPath = args[++i];
+		}
+		else if(std::strcmp(args[i], "--threads") == 0 && hasValue) {
+			threads = static_cast<size_t>(std::max(std::atoi(args[++i]), 0));
+		}
+		else if(std::strcmp(args[i], "--huge-pages") == 0) {
+			hugePages = true;
+		}
+		else if(std::strcmp(args[i], "--opcode-stats") == 0 && hasValue) {
+			opcodeStatsPath = args[++i];
+		}
+		else if(std::strcmp(args[i], "--profile") == 0 && hasValue) {
+			profilePath = args[++i];
+		}
+		else if(std::strcmp(args[i], "--profile-interval") == 0 && hasValue) {
+			profileInterval = static_cast<uint32_t>(std::max(std::atoi(args[++i]), 1));
+		}
+		else if(std::strcmp(args[i], "--symbols") == 0 && hasValue) {
+			symbolsPath = args[++i];
+		}
+		else if(std::strcmp(args[i], "--trace") == 0 && hasValue) {
+			tracePath = args[++i];
+		}
+		else if(std::strcmp(args[i], "--trace-size") == 0 && hasValue) {
+			traceSize = static_cast<size_t>(std::max(std::atoi(args[++i]), 1));
+		}
+		else if(std::strcmp(args[i], "--stats") == 0) {
+			printStats = true;
+		}
+		else if(std::strcmp(args[i], "--stats-json") == 0 && hasValue) {
+			statsJSONPath = args[++i];
+		}
+		else {
+			printUsage(args[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	// Batches need neither SDL nor the single VM below
+	if(batchPath) {
+		std::vector<gb_emu::BatchJob> jobs;
+		if(!gb_emu::readJobList(batchPath, jobs))
+			return EXIT_FAILURE;
+		gb_emu::BatchReport report = gb_emu::BatchRunner(threads, 60, hugePages).run(jobs);
+		bool allOk = true;
+		for(size_t i = 0; i < report.results.size(); ++i) {
+			const gb_emu::BatchResult& result = report.results[i];
+			if(result.ok) {
+				printf("%zu\t%llu\t%016llx\n", i, static_cast<unsigned long long>(result.frames),
+					static_cast<unsigned long long>(result.frameHash));
+			}
+			else {
+				printf("%zu\terror\t%s\n", i, result.error.c_str());
+				allOk = false;
+			}
+		}
+		fprintf(stderr, "%zu jobs, %llu frames in %.2fs on %zu threads: %.0f frames/s\n",
+			jobs.size(), static_cast<unsigned long long>(report.totalFrames), report.seconds,
+			report.threads, report.framesPerSecond());
+		fprintf(stderr, "Peak %zu KB per VM (budget %zu KB), plus %zu KB of caches%s\n", report.peakFootprint / 1024,
+			gb_emu::VM::FOOTPRINT_BUDGET / 1024, report.peakCaches / 1024, report.hugePages ? ", on huge pages" : "");
+		return allOk ? 0 : EXIT_FAILURE;
+	}
+
+	if(opcodeStatsPath && !gb_emu::OpcodeStatsPolicy::ENABLED) {
+		fprintf(stderr, "--opcode-stats needs a build with GB_EMU_OPCODE_STATS\n");
+		return EXIT_FAILURE;
+	}
+
+	std::unique_ptr<gb_emu::Profiler> profiler;
+	if(profilePath) {
+		profiler = std::make_unique<gb_emu::Profiler>(profileInterval);
+		if(symbolsPath && !profiler->loadSymbols(symbolsPath))
+			return EXIT_FAILURE;
+	}
+
+	FilePtr statsJSON;
+	if(statsJSONPath) {
+		statsJSON.reset(std::fopen(statsJSONPath, "a"));
+		if(!statsJSON) {
+			fprintf(stderr, "Failed to open %s\n", statsJSONPath);
+			return EXIT_FAILURE;
+		}
+	}
+
+	// Neither does a benchmark
+	if(bench) {
+		return runBenchmark(romPath, frameLimit, playPath, opcodeStatsPath, profiler.get(), profilePath,
+			tracePath, traceSize, statsJSON.get());
+	}
+
+	// Headless runs need something to end them
+	if(headless && !playPath && !frameLimit) {
+		fprintf(stderr, "--headless needs --frames or a movie to play\n");
+		printUsage(args[0]);
+		return EXIT_FAILURE;
+	}
+	// Movies can't go backwards
+	if(rewindSeconds && (recordPath || playPath || headless)) {
+		fprintf(stderr, "--rewind can't be used with movies or --headless\n");
+		return EXIT_FAILURE;
+	}
+	// Nor start anywhere but power-on
+	if(statePath && (recordPath || playPath)) {
+		fprintf(stderr, "--state can't be used with movies\n");
+		return EXIT_FAILURE;
+	}
+	// The APU's output can only have one consumer
+	if(audioCapturePath || headless) audio = false;
+
+	// The video driver has to be chosen before SDL is initialised
+	if(videoDriver) {
+		SDL_setenv("SDL_VIDEODRIVER", videoDriver, 1);
+	}
+	if(SDL_Init((headless ? 0 : SDL_INIT_VIDEO) | (audio ? SDL_INIT_AUDIO : 0)) != 0) {
+		fprintf(stderr, "Failed to initialise SDL: %s\n", SDL_GetError());
+		return EXIT_FAILURE;
+	}
+	SDLSession sdlSession;
+
+	FilePtr hashFile;
+	if(hashPath) {
+		hashFile.reset(std::fopen(hashPath, "w"));
+		if(!hashFile) {
+			fprintf(stderr, "Failed to open %s\n", hashPath);
+			return EXIT_FAILURE;
+		}
+	}
+
+	{
+		std::unique_ptr<gb_emu::LCD> lcd;
+		if(!headless)
+			lcd = std::make_unique<gb_emu::LCD>(renderDriver, scale);
+		gb_emu::VM vm(romPath);
+		if(!vm.isLoaded())
+			return EXIT_FAILURE;
+		vm.setProfiler(profiler.get());
+		if(tracePath)
+			vm.enableTrace(traceSize);
+		gb_emu::StatsMonitor stats;
+		auto reportStats = [&]() {
+			gb_emu::RuntimeStats snapshot = stats.read();
+			if(printStats) gb_emu::printStats(stderr, snapshot);
+			if(statsJSON) gb_emu::writeStatsJSON(statsJSON.get(), snapshot);
+		};
+		SDL_AudioDeviceID audioDevice = 0;
+		AudioOutput audioOutput{ vm.getAPU().getOutput(), nullptr, {}, stats };
+		if(audio) {
+			// Ask for 48kHz but take whatever rate the device prefers, since
+			// resampling happens here rather than in SDL
+			SDL_AudioSpec want = {}, have = {};
+			want.freq = 48000;
+			want.format = AUDIO_S16SYS;
+			want.channels = 2;
+			want.samples = 1024;
+			want.callback = audioCallback;
+			want.userdata = &audioOutput;
+			audioDevice = SDL_OpenAudioDevice(nullptr, 0, &want, &have, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+			if(audioDevice == 0)
+				fprintf(stderr, "Failed to open audio device: %s\n", SDL_GetError());
+			else {
+				// Devices open paused, so the callback can't run before this
+				audioOutput.resampler = std::make_unique<gb_emu::Resampler>(gb_emu::APU::SAMPLE_RATE, static_cast<uint32_t>(have.freq));
+				audioOutput.resampler->reserve(have.samples);
+				audioOutput.input.resize(audioOutput.resampler->maxInputFrames(have.samples) * 2);
+				vm.getAPU().setOutputEnabled(true);
+				SDL_PauseAudioDevice(audioDevice, 0);
+			}
+		}
+		std::unique_ptr<gb_emu::AudioCapture> audioCapture;
+		if(audioCapturePath) {
+			audioCapture = std::make_unique<gb_emu::AudioCapture>(audioCapturePath, audioFormat,
+				vm.getAPU().getOutput(), gb_emu::APU::SAMPLE_RATE);
+			if(!audioCapture->isOpen())
+				return EXIT_FAILURE;
+			vm.getAPU().setOutputEnabled(true);
+		}
+		// Quick save slot. F5 saves here (and to statePath), F9 loads from here
+		auto quickState = std::make_unique<gb_emu::SaveState>();
+		bool haveQuickState = false;
+		if(statePath) {
+			std::FILE* existing = std::fopen(statePath, "rb");
+			if(existing) {
+				std::fclose(existing);
+				haveQuickState = gb_emu::readSaveState(statePath, *quickState) && vm.loadState(*quickState);
+			}
+		}
+
+		std::unique_ptr<gb_emu::MovieRecorder> recorder;
+		if(recordPath) {
+			recorder = std::make_unique<gb_emu::MovieRecorder>(recordPath);
+			if(!recorder->isOpen())
+				return EXIT_FAILURE;
+		}
+		std::unique_ptr<gb_emu::MoviePlayer> player;
+		if(playPath) {
+			player = std::make_unique<gb_emu::MoviePlayer>(playPath);
+			if(!player->isOpen())
+				return EXIT_FAILURE;
+		}
+		std::unique_ptr<gb_emu::RewindBuffer> rewind;
+		if(rewindSeconds) {
+			size_t framesPerSecond = gb_emu::CLOCK_SPEED / gb_emu::PPU::CYCLES_PER_FRAME + 1;
+			rewind = std::make_unique<gb_emu::RewindBuffer>(rewindSeconds * framesPerSecond, rewindMemory << 20);
+		}
+		std::unique_ptr<gb_emu::FrameCapture> capture;
+		if(capturePath) {
+			capture = std::make_unique<gb_emu::FrameCapture>(capturePath, captureFormat);
+			if(!capture->isOpen())
+				return EXIT_FAILURE;
+		}
+
+		const double frameSeconds = static_cast<double>(gb_emu::PPU::CYCLES_PER_FRAME) / gb_emu::CLOCK_SPEED;
+		const Uint64 frameTicks = static_cast<Uint64>(frameSeconds * SDL_GetPerformanceFrequency());
+		Uint64 nextFrame = SDL_GetPerformanceCounter() + frameTicks;
+
+		bool quit = false;
+		bool redraw = false;
+		uint8_t keys = 0;
+		bool rewinding = false;
+		while(!quit) {
+			stats.beginFrame();
+			// Step back a frame instead of running one while rewind is held
+			if(rewinding && rewind->stepBack(vm)) {
+				lcd->present(vm.getFramebuffer());
+				redraw = true;
+			}
+			else {
+				// Input is sampled once per frame, so a movie can reproduce it exactly
+				uint64_t frame = vm.getFrameCount();
+				uint8_t input = player && !player->finished(frame) ? player->stateFor(frame) : keys;
+				vm.getJoypad().setState(input);
+				if(recorder)
+					recorder->record(frame, input);
+
+				if(vm.runFrame() == gb_emu::ExecuteResult::RUNTIME_ERROR) {
+					fprintf(stderr, "Instruction returned RUNTIME_ERROR\n");
+					if(tracePath)
+						vm.dumpTrace(tracePath);
+					break;
+				}
+				if(rewind)
+					rewind->push(vm);
+				if(hashFile) {
+					fprintf(hashFile.get(), "%llu %016llx\n", static_cast<unsigned long long>(vm.getFrameCount()),
+						static_cast<unsigned long long>(vm.getFrameHash()));
+				}
+				// The capture writes every sample, so don't wait for the ring to run low
+				if(audioCapture) {
+					audioCapture->throttle();
+					vm.getAPU().update();
+				}
+				if(capture) {
+					if(vm.frameChanged())
+						capture->submit(vm.getFramebuffer());
+					else
+						capture->submitRepeat(vm.getFramebuffer());
+				}
+				if(frameLimit && vm.getFrameCount() >= frameLimit)
+					quit = true;
+				if(headless) {
+					quit = quit || (player && player->finished(vm.getFrameCount()));
+					if(stats.endFrame(vm)) reportStats();
+					continue;
+				}
+
+				// Identical frames (menus, dialogue) don't need uploading again,
+				// unless the window needs redrawing
+				if(vm.frameChanged() || redraw) {
+					lcd->present(vm.getFramebuffer());
+					redraw = false;
+				}
+			}
+
+			SDL_Event event;
+			while(SDL_PollEvent(&event)) {
+				if(event.type == SDL_QUIT)
+					quit = true;
+				else if(event.type == SDL_WINDOWEVENT)
+					redraw = true;
+				else if(event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_F5) {
+					vm.saveState(*quickState);
+					haveQuickState = true;
+					if(statePath) gb_emu::writeSaveState(statePath, *quickState);
+				}
+				else if(event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_F9) {
+					// Loading would take a movie backwards, so isn't allowed during one.
+					// Show the restored frame straight away
+					if(!recorder && !player && haveQuickState && vm.loadState(*quickState))
+						lcd->present(vm.getFramebuffer());
+				}
+				else if(event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_F12) {
+					if(tracePath && vm.dumpTrace(tracePath))
+						fprintf(stderr, "Wrote trace to %s\n", tracePath);
+				}
+				else if(event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_r)
+					rewinding = rewind != nullptr;
+				else if(event.type == SDL_KEYUP && event.key.keysym.sym == SDLK_r)
+					rewinding = false;
+				else if(event.type == SDL_KEYDOWN)
+					keys |= buttonForKey(event.key.keysym.sym);
+				else if(event.type == SDL_KEYUP)
+					keys &= ~buttonForKey(event.key.keysym.sym);
+			}
+
+			if(stats.endFrame(vm)) reportStats();
+
+			// Wait out the rest of the frame, or catch up if we're behind
+			Uint64 now = SDL_GetPerformanceCounter();
+			if(now < nextFrame) {
+				SDL_Delay(static_cast<Uint32>((nextFrame - now) * 1000 / SDL_GetPerformanceFrequency()));
+				nextFrame += frameTicks;
+			}
+			else {
+				// This frame's deadline, and any more that went by, were missed
+				stats.countDroppedFrames(1 + (now - nextFrame) / frameTicks);
+				nextFrame = now + frameTicks;
+			}
+		}
 
-	gb_emu::VM vm;
-	vm.run();
+		if(recorder)
+			recorder->close(vm.getFrameCount());
+		if(audioDevice) SDL_CloseAudioDevice(audioDevice);
+		if(printStats || statsJSON) {
+			stats.publish(vm);
+			reportStats();
+		}
+		if(audioCapture) {
+			audioCapture->close();
+			fprintf(stderr, "Audio checksum %016llx over %llu samples\n",
+				static_cast<unsigned long long>(audioCapture->getChecksum()),
+				static_cast<unsigned long long>(audioCapture->getWrittenSamples()));
+			if(vm.getAPU().getDroppedSamples()) {
+				fprintf(stderr, "Audio capture dropped %llu samples\n",
+					static_cast<unsigned long long>(vm.getAPU().getDroppedSamples()));
+			}
+		}
+		if(capture && capture->getDroppedFrames()) {
+			fprintf(stderr, "Capture dropped %llu frames\n", static_cast<unsigned long long>(capture->getDroppedFrames()));
+		}
+		if(opcodeStatsPath)
+			vm.getOpcodeStats().writeReport(opcodeStatsPath);
+		if(profiler)
+			profiler->writeFolded(profilePath);
+	}
 
-	SDL_Quit();
 	return 0;
-}
\ No newline at end of file
+}
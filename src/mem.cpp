@@ -1,8 +1,10 @@
 #include "..\include\mem.hpp"
 #include "..\include\reservedAddresses.hpp"
 #include "..\include\mbc.hpp"
+#include "../include/iodevice.hpp"
 #include <filesystem>
 #include <cstdio>
+#include <cstring>
 #include <gsl/gsl_util>
 namespace fs = std::filesystem;
 
@@ -15,13 +17,149 @@ namespace gb_emu
 			mbc = nullptr;
 		}
 	}
+	MMU::MMU()
+	{
+		resetPages();
+	}
+	MMU::MMU(ForkTag)
+	{
+		mapOwnPages();
+	}
 	MMU::~MMU()
 	{
 		clear();
 	}
+
+	void MMU::resetPages()
+	{
+		std::fill(std::begin(memory), std::end(memory), 0);
+		mapOwnPages();
+	}
+
+	void MMU::mapOwnPages()
+	{
+		// ROM pages read as 0 until a cartridge is mapped
+		static const uint8_t unmapped[PAGE_SIZE] = {};
+		for(size_t page = 0; page < FIRST_RAM_PAGE; ++page) {
+			pages[page] = unmapped;
+		}
+		for(size_t page = FIRST_RAM_PAGE; page < PAGE_COUNT; ++page) {
+			pages[page] = &memory[(page - FIRST_RAM_PAGE) * PAGE_SIZE];
+		}
+		std::fill(std::begin(ownedPages), std::end(ownedPages), 0);
+		for(size_t page = FIRST_RAM_PAGE; page < PAGE_COUNT; ++page) {
+			ownedPages[page >> 6] |= 1ULL << (page & 63);
+		}
+		sharedPageCount = 0;
+		base.reset();
+	}
+
+	void MMU::mapROM()
+	{
+		if(!cartridgeROM) return;
+		const uint8_t* rom = cartridgeROM->data();
+		size_t banks = cartridgeROM->size() / ROM_BLOCK_SIZE;
+		// Out of range banks wrap, as the unused high bank bits aren't connected
+		size_t bank = (mbc ? mbc->getROMBank() : 1) % banks;
+		romBank = static_cast<uint16_t>(bank);
+		constexpr size_t bankPages = ROM_BLOCK_SIZE / PAGE_SIZE;
+		for(size_t page = 0; page < bankPages; ++page) {
+			pages[page] = rom + page * PAGE_SIZE;
+			pages[bankPages + page] = rom + bank * ROM_BLOCK_SIZE + page * PAGE_SIZE;
+		}
+	}
+
+	void MMU::copyPage(uint8_t page)
+	{
+		uint8_t* own = &memory[(page - FIRST_RAM_PAGE) * PAGE_SIZE];
+		std::memcpy(own, pages[page], PAGE_SIZE);
+		pages[page] = own;
+		ownedPages[page >> 6] |= 1ULL << (page & 63);
+		--sharedPageCount;
+	}
+
+	size_t MMU::getHeapSize() const
+	{
+		return mbc ? sizeof(*mbc) : 0;
+	}
+
+	size_t MMU::getSharedSize() const
+	{
+		return (cartridgeROM ? cartridgeROM->size() : 0) + (base ? sizeof(SharedMemory) : 0);
+	}
+
+	void MMU::ownRange(uint16_t addr, size_t size)
+	{
+		if(sharedPageCount == 0) return;
+		for(size_t page = addr / PAGE_SIZE; page <= (addr + size - 1) / PAGE_SIZE; ++page) {
+			if(!isOwned(static_cast<uint8_t>(page))) copyPage(static_cast<uint8_t>(page));
+		}
+	}
+
+	void MMU::freeze()
+	{
+		constexpr size_t shareable = OAM_TABLE / PAGE_SIZE - FIRST_RAM_PAGE;
+		// Nothing owned but the pinned pages means base is still current
+		if(base && sharedPageCount == shareable) return;
+
+		auto image = std::make_shared<SharedMemory>();
+		for(size_t page = FIRST_RAM_PAGE; page < PAGE_COUNT; ++page) {
+			std::memcpy(&image->memory[(page - FIRST_RAM_PAGE) * PAGE_SIZE], pages[page], PAGE_SIZE);
+		}
+		for(size_t page = FIRST_RAM_PAGE; page < OAM_TABLE / PAGE_SIZE; ++page) {
+			pages[page] = &image->memory[(page - FIRST_RAM_PAGE) * PAGE_SIZE];
+			ownedPages[page >> 6] &= ~(1ULL << (page & 63));
+		}
+		sharedPageCount = shareable;
+		base = std::move(image);
+	}
+
+	void MMU::forkFrom(MMU& parent)
+	{
+		clear();
+		parent.freeze();
+		base = parent.base;
+		cartridgeROM = parent.cartridgeROM;
+		if(parent.mbc) mbc = parent.mbc->clone();
+
+		mapROM();
+		for(size_t page = FIRST_RAM_PAGE; page < PAGE_COUNT; ++page) {
+			pages[page] = &base->memory[(page - FIRST_RAM_PAGE) * PAGE_SIZE];
+		}
+		std::fill(std::begin(ownedPages), std::end(ownedPages), 0);
+		sharedPageCount = STATE_PAGES;
+		// The pinned pages have moved on since base was taken, so come from the parent
+		for(size_t page = OAM_TABLE / PAGE_SIZE; page < PAGE_COUNT; ++page) {
+			pages[page] = parent.pages[page];
+			copyPage(static_cast<uint8_t>(page));
+		}
+		std::copy(std::begin(parent.dirtyPages), std::end(parent.dirtyPages), std::begin(dirtyPages));
+
+		oamIndex.setTallSprites(ram(LCD_CONTROL) & 0x04);
+		oamIndex.rebuild(&ram(OAM_TABLE));
+		tileMapCache.invalidate();
+	}
+
+	const uint8_t* MMU::getRegion(uint16_t addr, size_t size)
+	{
+		if(sharedPageCount == 0) return &ram(addr);
+		size_t first = addr / PAGE_SIZE;
+		size_t last = (addr + size - 1) / PAGE_SIZE;
+		bool anyOwned = false;
+		bool anyShared = false;
+		for(size_t page = first; page <= last; ++page) {
+			if(isOwned(static_cast<uint8_t>(page))) anyOwned = true;
+			else anyShared = true;
+		}
+		// Untouched since the fork, so the shared image is contiguous and current
+		if(!anyOwned) return &base->memory[addr - VRAM_BANK];
+		if(anyShared) ownRange(addr, size);
+		return &ram(addr);
+	}
 	void MMU::loadFromFile(std::string path)
 	{
 		clear();
+		resetPages();
 		fs::path p = path;
 
 		if(!fs::exists(p)) {
@@ -45,15 +183,15 @@ namespace gb_emu
 			// We know from above that size can't be bigger than MAX_CARTRIDGE_SIZE
 			// so this narrowing cast is fine
 			size_t sz = static_cast<size_t>(size);
-			cartridgeROM.resize(sz);
-			std::fread(&(cartridgeROM[0]), sizeof(cartridgeROM[0]), sz, fp);
-
-			// Copy the first ROM block over to system ram
-			std::memcpy(&(memory[FIXED_ROM_BANK]), &(cartridgeROM[0]), ROM_BLOCK_SIZE);
-			std::memcpy(&(memory[SWITCHABLE_ROM_BANK]), &(cartridgeROM[ROM_BLOCK_SIZE]), ROM_BLOCK_SIZE);
+			// Whole banks, and at least two, so every ROM page can be mapped
+			size_t banks = std::max<size_t>((sz + ROM_BLOCK_SIZE - 1) / ROM_BLOCK_SIZE, 2);
+			auto rom = std::make_shared<std::vector<uint8_t>>(banks * ROM_BLOCK_SIZE, 0xFF);
+			std::fread(&((*rom)[0]), sizeof((*rom)[0]), sz, fp);
+			uint8_t cartridgeType = (*rom)[CARTRIDGE_TYPE_FLAG];
+			cartridgeROM = std::move(rom);
 
 			// Check the cartridge type and set the correct MBC
-			switch(memory[CARTRIDGE_TYPE_FLAG]) {
+			switch(cartridgeType) {
 			case 0x1: case 0x02: case 0x03:
 				mbc = new MBC1();
 				break;
@@ -75,34 +213,160 @@ namespace gb_emu
 			default:
 				mbc = new MBC_Null();
 			}
+			mapROM();
 		}
 		catch(std::exception &e) {
 			fprintf(stderr, "Error reading file: %s with error %s\n", path.c_str(), e.what());
 			return;
 		}
 	}
+	void MMU::mapIO(uint16_t first, uint16_t last, IODevice* device)
+	{
+		for(uint16_t addr = first; addr <= last; ++addr) {
+			ioDevices[addr - IO_REGISTERS] = device;
+		}
+	}
+
+	void MMU::saveState(State& state) const
+	{
+		for(size_t page = 0; page < STATE_PAGES; ++page) {
+			std::memcpy(&state.memory[page * PAGE_SIZE], pages[page + FIRST_RAM_PAGE], PAGE_SIZE);
+		}
+		if(mbc) mbc->saveState(state.mbc);
+	}
+
+	void MMU::loadState(const State& state)
+	{
+		// Everything loaded is overwritten, so shared pages needn't be copied first
+		for(size_t page = FIRST_RAM_PAGE; page < PAGE_COUNT; ++page) {
+			if(isOwned(static_cast<uint8_t>(page))) continue;
+			pages[page] = &memory[(page - FIRST_RAM_PAGE) * PAGE_SIZE];
+			ownedPages[page >> 6] |= 1ULL << (page & 63);
+			--sharedPageCount;
+		}
+		std::memcpy(memory, state.memory, sizeof(state.memory));
+		if(mbc) {
+			mbc->loadState(state.mbc);
+			mapROM();
+		}
+		oamIndex.setTallSprites(ram(LCD_CONTROL) & 0x04);
+		oamIndex.rebuild(&ram(OAM_TABLE));
+		tileMapCache.invalidate();
+	}
+
+	void MMU::saveDelta(DeltaState& delta) const
+	{
+		delta.pages.clear();
+		std::fill(std::begin(delta.pageMask), std::end(delta.pageMask), 0);
+		for(size_t page = 0; page < STATE_PAGES; ++page) {
+			size_t absolute = page + FIRST_RAM_PAGE;
+			if(!isPageDirty(static_cast<uint8_t>(absolute))) continue;
+			delta.pageMask[page / 64] |= 1ULL << (page % 64);
+			const uint8_t* src = pages[absolute];
+			delta.pages.insert(delta.pages.end(), src, src + PAGE_SIZE);
+		}
+		if(mbc) mbc->saveState(delta.mbc);
+	}
+
+	void MMU::applyDelta(State& state, const DeltaState& delta)
+	{
+		const uint8_t* src = delta.pages.data();
+		for(size_t page = 0; page < STATE_PAGES; ++page) {
+			if(!((delta.pageMask[page / 64] >> (page % 64)) & 1)) continue;
+			std::memcpy(&state.memory[page * PAGE_SIZE], src, PAGE_SIZE);
+			src += PAGE_SIZE;
+		}
+		state.mbc = delta.mbc;
+	}
+
 	uint8_t MMU::getByte(uint16_t addr) const
 	{
-		return memory[addr];
+		if(addr >= IO_REGISTERS && addr < HRAM) {
+			IODevice* device = ioDevices[addr - IO_REGISTERS];
+			if(device) return device->readIO(addr);
+		}
+		return pages[addr >> 8][addr & 0xFF];
 	}
 
 	void  MMU::setByte(uint16_t addr, uint8_t value)
 	{
 		// If trying to write to the ROM section, pass the call to the MBC
 		if(addr <= SWITCHABLE_ROM_BANK_END) {
-			mbc->captureWrite(addr, value, cartridgeROM, memory);
+			if(!mbc) return;
+			uint16_t previousBank = romBank;
+			mbc->captureWrite(addr, value);
+			mapROM();
+			bankSwitches += romBank != previousBank;
+		}
+		else if(addr >= OAM_TABLE) {
+			setHighByte(addr, value);
 		}
 		// Otherwise write as normal
 		else {
 			// Perform echo writes
 			if(addr >= WORKING_RAM_BANK && addr <= WORKING_RAM_BANK_ECHO_END) {
-				memory[addr + ECHO_OFFSET] = value;
+				own(addr + ECHO_OFFSET);
+				ram(addr + ECHO_OFFSET) = value;
+				markDirty(addr + ECHO_OFFSET);
 			}
 			if(addr >= ECHO_RAM_BANK && addr <= ECHO_RAM_BANK_END) {
-				memory[addr - ECHO_OFFSET] = value;
+				own(addr - ECHO_OFFSET);
+				ram(addr - ECHO_OFFSET) = value;
+				markDirty(addr - ECHO_OFFSET);
+			}
+
+			own(addr);
+			ram(addr) = value;
+			markDirty(addr);
+			if(addr <= VRAM_BANK_END) {
+				tileMapCache.write(addr);
+			}
+		}
+	}
+
+	void MMU::setHighByte(uint16_t addr, uint8_t value)
+	{
+		// Device writes which touch memory mark it themselves
+		markDirty(addr);
+		if(addr <= OAM_TABLE_END) {
+			ram(addr) = value;
+			oamIndex.write(static_cast<uint8_t>(addr - OAM_TABLE), value);
+			return;
+		}
+
+		if(addr >= IO_REGISTERS && addr < HRAM) {
+			IODevice* device = ioDevices[addr - IO_REGISTERS];
+			if(device) {
+				device->writeIO(addr, value);
+				return;
 			}
+		}
 
-			memory[addr] = value;
+		switch(addr) {
+		case LCD_CONTROL:
+			oamIndex.setTallSprites(value & 0x04);
+			break;
+		case LCD_Y:
+			// Read only
+			return;
+		case OAM_DMA:
+			ram(addr) = value;
+			doOAMDMA(value);
+			return;
+		}
+		ram(addr) = value;
+	}
+
+	void MMU::doOAMDMA(uint8_t source)
+	{
+		// Real hardware takes 160 cycles and blocks most of the bus meanwhile,
+		// but as the CPU can only run from HRAM during that time, doing the
+		// copy at once is indistinguishable for well behaved games
+		uint16_t base = static_cast<uint16_t>(source) << 8;
+		for(uint16_t i = 0; i < OAM_SIZE; ++i) {
+			ram(OAM_TABLE + i) = getByte(base + i);
 		}
+		markDirty(OAM_TABLE);
+		oamIndex.rebuild(&ram(OAM_TABLE));
 	}
 }
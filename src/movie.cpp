@@ -0,0 +1,119 @@
+#include "../include/movie.hpp"
+#include <algorithm>
+#include <iterator>
+
+namespace gb_emu
+{
+	MovieRecorder::MovieRecorder(const std::string& path)
+	{
+		out = std::fopen(path.c_str(), "wb");
+		if(!out) {
+			fprintf(stderr, "Failed to open movie for recording: %s\n", path.c_str());
+			return;
+		}
+		std::fwrite(movie::MAGIC, 1, sizeof(movie::MAGIC), out);
+		std::fputc(movie::VERSION, out);
+	}
+
+	MovieRecorder::~MovieRecorder()
+	{
+		if(out) close(lastFrame);
+	}
+
+	bool MovieRecorder::record(uint64_t frame, uint8_t state)
+	{
+		if(!out) return false;
+		// The format only stores frames since the previous record
+		if(frame < lastFrame) {
+			fprintf(stderr, "Movie frames can't go backwards (frame %llu after %llu)\n",
+				static_cast<unsigned long long>(frame), static_cast<unsigned long long>(lastFrame));
+			return false;
+		}
+		if(state != lastState) writeRecord(frame, state);
+		return true;
+	}
+
+	void MovieRecorder::close(uint64_t frame)
+	{
+		if(!out) return;
+		writeRecord(std::max(frame, lastFrame), lastState);
+		std::fclose(out);
+		out = nullptr;
+	}
+
+	void MovieRecorder::writeRecord(uint64_t frame, uint8_t state)
+	{
+		uint64_t delta = frame - lastFrame;
+		do {
+			uint8_t byte = delta & 0x7F;
+			delta >>= 7;
+			std::fputc(delta ? byte | 0x80 : byte, out);
+		} while(delta);
+		std::fputc(state, out);
+		lastFrame = frame;
+		lastState = state;
+	}
+
+	MoviePlayer::MoviePlayer(const std::string& path)
+	{
+		std::FILE* fp = std::fopen(path.c_str(), "rb");
+		if(!fp) {
+			fprintf(stderr, "Failed to open movie: %s\n", path.c_str());
+			return;
+		}
+		std::vector<uint8_t> data;
+		uint8_t buffer[4096];
+		size_t read;
+		while((read = std::fread(buffer, 1, sizeof(buffer), fp)) > 0)
+			data.insert(data.end(), buffer, buffer + read);
+		std::fclose(fp);
+
+		if(data.size() < sizeof(movie::MAGIC) + 1 || !std::equal(std::begin(movie::MAGIC), std::end(movie::MAGIC), data.begin())) {
+			fprintf(stderr, "Not an input movie: %s\n", path.c_str());
+			return;
+		}
+		if(data[sizeof(movie::MAGIC)] != movie::VERSION) {
+			fprintf(stderr, "Unsupported movie version %u: %s\n", data[sizeof(movie::MAGIC)], path.c_str());
+			return;
+		}
+
+		uint64_t frame = 0;
+		for(size_t pos = sizeof(movie::MAGIC) + 1; pos < data.size();) {
+			uint64_t delta = 0;
+			int shift = 0;
+			uint8_t byte;
+			do {
+				if(pos >= data.size() || shift > 63) {
+					fprintf(stderr, "Truncated movie: %s\n", path.c_str());
+					return;
+				}
+				byte = data[pos++];
+				delta |= static_cast<uint64_t>(byte & 0x7F) << shift;
+				shift += 7;
+			} while(byte & 0x80);
+			if(pos >= data.size()) {
+				fprintf(stderr, "Truncated movie: %s\n", path.c_str());
+				return;
+			}
+			frame += delta;
+			changes.push_back({ frame, data[pos++] });
+		}
+		open = true;
+	}
+
+	uint8_t MoviePlayer::stateFor(uint64_t frame)
+	{
+		// Rewind if asked for an earlier frame than last time
+		if(next > 0 && changes[next - 1].frame > frame)
+			next = 0;
+		while(next < changes.size() && changes[next].frame <= frame)
+			++next;
+		return next > 0 ? changes[next - 1].state : 0;
+	}
+
+	uint64_t MoviePlayer::nextChange(uint64_t frame)
+	{
+		stateFor(frame);
+		return next < changes.size() ? changes[next].frame : UINT64_MAX;
+	}
+}
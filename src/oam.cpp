@@ -0,0 +1,118 @@
+#include "../include/oam.hpp"
+#include <algorithm>
+#include <iterator>
+
+namespace gb_emu
+{
+	OAMIndex::OAMIndex()
+	{
+		std::fill(std::begin(lineDirty), std::end(lineDirty), true);
+	}
+
+	void OAMIndex::write(uint8_t offset, uint8_t value)
+	{
+		uint8_t sprite = offset / 4;
+		if(sprite >= SPRITE_COUNT) return;
+
+		switch(offset % 4) {
+		case 0: // Y position changes which lines the sprite is on
+			if(spriteY[sprite] == value) return;
+			removeSprite(sprite);
+			spriteY[sprite] = value;
+			addSprite(sprite);
+			break;
+		case 1: // X position only changes the order within a line
+			if(spriteX[sprite] == value) return;
+			spriteX[sprite] = value;
+			markDirty(sprite);
+			break;
+		default: // Tile and attributes don't affect selection
+			break;
+		}
+	}
+
+	void OAMIndex::rebuild(const uint8_t* oam)
+	{
+		std::fill(std::begin(lineMasks), std::end(lineMasks), 0);
+		std::fill(std::begin(lineDirty), std::end(lineDirty), true);
+		for(uint8_t sprite = 0; sprite < SPRITE_COUNT; ++sprite) {
+			spriteY[sprite] = oam[sprite * 4];
+			spriteX[sprite] = oam[sprite * 4 + 1];
+			addSprite(sprite);
+		}
+	}
+
+	void OAMIndex::setTallSprites(bool tall)
+	{
+		uint8_t height = tall ? 16 : 8;
+		if(height == spriteHeight) return;
+
+		for(uint8_t sprite = 0; sprite < SPRITE_COUNT; ++sprite)
+			removeSprite(sprite);
+		spriteHeight = height;
+		for(uint8_t sprite = 0; sprite < SPRITE_COUNT; ++sprite)
+			addSprite(sprite);
+	}
+
+	const OAMIndex::LineSprites& OAMIndex::line(uint8_t ly)
+	{
+		LineSprites& list = lines[ly];
+		if(!lineDirty[ly]) return list;
+
+		// Hardware picks the first 10 sprites in OAM order...
+		list.count = 0;
+		uint64_t mask = lineMasks[ly];
+		for(uint8_t sprite = 0; mask && list.count < MAX_SPRITES_PER_LINE; ++sprite, mask >>= 1) {
+			if(mask & 1)
+				list.sprites[list.count++] = sprite;
+		}
+		// ...then draws them by X, with OAM order breaking ties. Insertion sort
+		// is stable and there are at most 10
+		for(uint8_t i = 1; i < list.count; ++i) {
+			uint8_t sprite = list.sprites[i];
+			uint8_t j = i;
+			for(; j > 0 && spriteX[list.sprites[j - 1]] > spriteX[sprite]; --j)
+				list.sprites[j] = list.sprites[j - 1];
+			list.sprites[j] = sprite;
+		}
+		lineDirty[ly] = false;
+		return list;
+	}
+
+	void OAMIndex::addSprite(uint8_t sprite)
+	{
+		int first, last;
+		lineRange(sprite, first, last);
+		for(int ly = first; ly < last; ++ly) {
+			lineMasks[ly] |= (uint64_t(1) << sprite);
+			lineDirty[ly] = true;
+		}
+	}
+
+	void OAMIndex::removeSprite(uint8_t sprite)
+	{
+		int first, last;
+		lineRange(sprite, first, last);
+		for(int ly = first; ly < last; ++ly) {
+			lineMasks[ly] &= ~(uint64_t(1) << sprite);
+			lineDirty[ly] = true;
+		}
+	}
+
+	void OAMIndex::markDirty(uint8_t sprite)
+	{
+		int first, last;
+		lineRange(sprite, first, last);
+		for(int ly = first; ly < last; ++ly)
+			lineDirty[ly] = true;
+	}
+
+	void OAMIndex::lineRange(uint8_t sprite, int& first, int& last) const
+	{
+		// OAM Y is the screen line + 16, so sprites can sit partly above the screen
+		int top = static_cast<int>(spriteY[sprite]) - 16;
+		first = std::max(top, 0);
+		last = std::min(top + static_cast<int>(spriteHeight), static_cast<int>(SCREEN_HEIGHT));
+		if(last < first) last = first;
+	}
+}
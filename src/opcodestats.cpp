@@ -0,0 +1,171 @@
+#include "../include/opcodestats.hpp"
+#include "../include/op_code.hpp"
+#include "../include/common.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+namespace gb_emu
+{
+	namespace
+	{
+		using NamedOpcode = std::pair<uint8_t, const char*>;
+
+#define OPCODE(name) NamedOpcode{ toUType(Opcode_Exact::name), #name }
+		const NamedOpcode OPCODE_NAMES[] = {
+			OPCODE(NOP), OPCODE(LD_B_n), OPCODE(LD_C_n), OPCODE(LD_D_n), OPCODE(LD_E_n), OPCODE(LD_H_n),
+			OPCODE(LD_L_n), OPCODE(LD_A_A), OPCODE(LD_A_B), OPCODE(LD_A_C), OPCODE(LD_A_D), OPCODE(LD_A_E),
+			OPCODE(LD_A_H), OPCODE(LD_A_L), OPCODE(LD_A_HL), OPCODE(LD_B_B), OPCODE(LD_B_C), OPCODE(LD_B_D),
+			OPCODE(LD_B_E), OPCODE(LD_B_H), OPCODE(LD_B_L), OPCODE(LD_B_HL), OPCODE(LD_C_B), OPCODE(LD_C_C),
+			OPCODE(LD_C_D), OPCODE(LD_C_E), OPCODE(LD_C_H), OPCODE(LD_C_L), OPCODE(LD_C_HL), OPCODE(LD_D_B),
+			OPCODE(LD_D_C), OPCODE(LD_D_D), OPCODE(LD_D_E), OPCODE(LD_D_H), OPCODE(LD_D_L), OPCODE(LD_D_HL),
+			OPCODE(LD_E_B), OPCODE(LD_E_C), OPCODE(LD_E_D), OPCODE(LD_E_E), OPCODE(LD_E_H), OPCODE(LD_E_L),
+			OPCODE(LD_E_HL), OPCODE(LD_H_B), OPCODE(LD_H_C), OPCODE(LD_H_D), OPCODE(LD_H_E), OPCODE(LD_H_H),
+			OPCODE(LD_H_L), OPCODE(LD_H_HL), OPCODE(LD_L_B), OPCODE(LD_L_C), OPCODE(LD_L_D), OPCODE(LD_L_E),
+			OPCODE(LD_L_H), OPCODE(LD_L_L), OPCODE(LD_L_HL), OPCODE(LD_HL_B), OPCODE(LD_HL_C),
+			OPCODE(LD_HL_D), OPCODE(LD_HL_E), OPCODE(LD_HL_H), OPCODE(LD_HL_L), OPCODE(LD_HL_n),
+			OPCODE(LD_A_BC), OPCODE(LD_A_DE), OPCODE(LD_A_n), OPCODE(LD_A_nn), OPCODE(LD_B_A),
+			OPCODE(LD_C_A), OPCODE(LD_D_A), OPCODE(LD_E_A), OPCODE(LD_H_A), OPCODE(LD_L_A), OPCODE(LD_BC_A),
+			OPCODE(LD_DE_A), OPCODE(LD_HL_A), OPCODE(LD_nn_A), OPCODE(LD_A_offsetC), OPCODE(LD_offsetC_A),
+			OPCODE(LDD_A_HL), OPCODE(LDD_HL_A), OPCODE(LDI_A_HL), OPCODE(LDI_HL_A), OPCODE(LDH_n_A),
+			OPCODE(LDH_A_n), OPCODE(LD_BC_nn), OPCODE(LD_DE_nn), OPCODE(LD_HL_nn), OPCODE(LD_SP_nn),
+			OPCODE(LD_SP_HL), OPCODE(LDHL_SP_n), OPCODE(LD_nn_SP), OPCODE(PUSH_AF), OPCODE(PUSH_BC),
+			OPCODE(PUSH_DE), OPCODE(PUSH_HL), OPCODE(POP_AF), OPCODE(POP_BC), OPCODE(POP_DE), OPCODE(POP_HL),
+			OPCODE(ADD_A_A), OPCODE(ADD_A_B), OPCODE(ADD_A_C), OPCODE(ADD_A_D), OPCODE(ADD_A_E),
+			OPCODE(ADD_A_H), OPCODE(ADD_A_L), OPCODE(ADD_A_HL), OPCODE(ADD_A_n), OPCODE(ADC_A_A),
+			OPCODE(ADC_A_B), OPCODE(ADC_A_C), OPCODE(ADC_A_D), OPCODE(ADC_A_E), OPCODE(ADC_A_H),
+			OPCODE(ADC_A_L), OPCODE(ADC_A_HL), OPCODE(ADC_A_n), OPCODE(SUB_A), OPCODE(SUB_B), OPCODE(SUB_C),
+			OPCODE(SUB_D), OPCODE(SUB_E), OPCODE(SUB_H), OPCODE(SUB_L), OPCODE(SUB_HL), OPCODE(SUB_n),
+			OPCODE(SBC_A_A), OPCODE(SBC_A_B), OPCODE(SBC_A_C), OPCODE(SBC_A_D), OPCODE(SBC_A_E),
+			OPCODE(SBC_A_H), OPCODE(SBC_A_L), OPCODE(SBC_A_HL), OPCODE(SBC_A_n), OPCODE(AND_A),
+			OPCODE(AND_B), OPCODE(AND_C), OPCODE(AND_D), OPCODE(AND_E), OPCODE(AND_H), OPCODE(AND_L),
+			OPCODE(AND_HL), OPCODE(AND_n), OPCODE(OR_A), OPCODE(OR_B), OPCODE(OR_C), OPCODE(OR_D),
+			OPCODE(OR_E), OPCODE(OR_H), OPCODE(OR_L), OPCODE(OR_HL), OPCODE(OR_n), OPCODE(XOR_A),
+			OPCODE(XOR_B), OPCODE(XOR_C), OPCODE(XOR_D), OPCODE(XOR_E), OPCODE(XOR_H), OPCODE(XOR_L),
+			OPCODE(XOR_HL), OPCODE(XOR_n), OPCODE(CP_A), OPCODE(CP_B), OPCODE(CP_C), OPCODE(CP_D),
+			OPCODE(CP_E), OPCODE(CP_H), OPCODE(CP_L), OPCODE(CP_HL), OPCODE(CP_n), OPCODE(INC_A),
+			OPCODE(INC_B), OPCODE(INC_C), OPCODE(INC_D), OPCODE(INC_E), OPCODE(INC_H), OPCODE(INC_L),
+			OPCODE(INC_addressHL), OPCODE(DEC_A), OPCODE(DEC_B), OPCODE(DEC_C), OPCODE(DEC_D), OPCODE(DEC_E),
+			OPCODE(DEC_H), OPCODE(DEC_L), OPCODE(DEC_addressHL), OPCODE(ADD_HL_BC), OPCODE(ADD_HL_DE),
+			OPCODE(ADL_HL_HL), OPCODE(ADD_HL_SP), OPCODE(ADD_SP_n), OPCODE(INC_BC), OPCODE(INC_DE),
+			OPCODE(INC_HL), OPCODE(INC_SP), OPCODE(DEC_BC), OPCODE(DEC_DE), OPCODE(DEC_HL), OPCODE(DEC_SP),
+			OPCODE(CB), OPCODE(DAA), OPCODE(CPL), OPCODE(CCF), OPCODE(SCF), OPCODE(HALT), OPCODE(STOP),
+			OPCODE(DI), OPCODE(EI), OPCODE(RLCA), OPCODE(RLA), OPCODE(RRCA), OPCODE(RRA), OPCODE(JP_nn),
+			OPCODE(JP_NZ_nn), OPCODE(JP_Z_nn), OPCODE(JP_NC_nn), OPCODE(JP_C_nn), OPCODE(JP_HL),
+			OPCODE(JR_n), OPCODE(JR_NZ_n), OPCODE(JR_Z_n), OPCODE(JR_NC_n), OPCODE(JR_C_n), OPCODE(CALL_nn),
+			OPCODE(CALL_NZ_nn), OPCODE(CALL_Z_nn), OPCODE(CALL_NC_nn), OPCODE(CALL_C_nn), OPCODE(RST_00H),
+			OPCODE(RST_08H), OPCODE(RST_10H), OPCODE(RST_18H), OPCODE(RST_20H), OPCODE(RST_28H),
+			OPCODE(RST_30H), OPCODE(RST_38H), OPCODE(RET), OPCODE(RET_NZ), OPCODE(RET_Z), OPCODE(RET_NC),
+			OPCODE(RET_C), OPCODE(RETI)
+		};
+#undef OPCODE
+
+#define CB_OPCODE(name) NamedOpcode{ toUType(CB_Opcode_Exact::name), #name }
+		const NamedOpcode CB_OPCODE_NAMES[] = {
+			CB_OPCODE(SWAP_A), CB_OPCODE(SWAP_B), CB_OPCODE(SWAP_C), CB_OPCODE(SWAP_D), CB_OPCODE(SWAP_E),
+			CB_OPCODE(SWAP_H), CB_OPCODE(SWAP_L), CB_OPCODE(SWAP_HL), CB_OPCODE(RLC_A), CB_OPCODE(RLC_B),
+			CB_OPCODE(RLC_C), CB_OPCODE(RLC_D), CB_OPCODE(RLC_E), CB_OPCODE(RLC_H), CB_OPCODE(RLC_L),
+			CB_OPCODE(RLC_HL), CB_OPCODE(RL_A), CB_OPCODE(RL_B), CB_OPCODE(RL_C), CB_OPCODE(RL_D),
+			CB_OPCODE(RL_E), CB_OPCODE(RL_H), CB_OPCODE(RL_L), CB_OPCODE(RL_HL), CB_OPCODE(RRC_A),
+			CB_OPCODE(RRC_B), CB_OPCODE(RRC_C), CB_OPCODE(RRC_D), CB_OPCODE(RRC_E), CB_OPCODE(RRC_H),
+			CB_OPCODE(RRC_L), CB_OPCODE(RRC_HL), CB_OPCODE(RR_A), CB_OPCODE(RR_B), CB_OPCODE(RR_C),
+			CB_OPCODE(RR_D), CB_OPCODE(RR_E), CB_OPCODE(RR_H), CB_OPCODE(RR_L), CB_OPCODE(RR_HL),
+			CB_OPCODE(SLA_A), CB_OPCODE(SLA_B), CB_OPCODE(SLA_C), CB_OPCODE(SLA_D), CB_OPCODE(SLA_E),
+			CB_OPCODE(SLA_H), CB_OPCODE(SLA_L), CB_OPCODE(SLA_HL), CB_OPCODE(SRA_A), CB_OPCODE(SRA_B),
+			CB_OPCODE(SRA_C), CB_OPCODE(SRA_D), CB_OPCODE(SRA_E), CB_OPCODE(SRA_H), CB_OPCODE(SRA_L),
+			CB_OPCODE(SRA_HL), CB_OPCODE(SRL_A), CB_OPCODE(SRL_B), CB_OPCODE(SRL_C), CB_OPCODE(SRL_D),
+			CB_OPCODE(SRL_E), CB_OPCODE(SRL_H), CB_OPCODE(SRL_L), CB_OPCODE(SRL_HL), CB_OPCODE(BIT_b_A),
+			CB_OPCODE(BIT_b_B), CB_OPCODE(BIT_b_C), CB_OPCODE(BIT_b_D), CB_OPCODE(BIT_b_E),
+			CB_OPCODE(BIT_b_H), CB_OPCODE(BIT_b_L), CB_OPCODE(BIT_b_HL), CB_OPCODE(SET_b_A),
+			CB_OPCODE(SET_b_B), CB_OPCODE(SET_b_C), CB_OPCODE(SET_b_D), CB_OPCODE(SET_b_E),
+			CB_OPCODE(SET_b_H), CB_OPCODE(SET_b_L), CB_OPCODE(SET_b_HL), CB_OPCODE(RES_b_A),
+			CB_OPCODE(RES_b_B), CB_OPCODE(RES_b_C), CB_OPCODE(RES_b_D), CB_OPCODE(RES_b_E),
+			CB_OPCODE(RES_b_H), CB_OPCODE(RES_b_L), CB_OPCODE(RES_b_HL)
+		};
+#undef CB_OPCODE
+
+		const char* lookup(const NamedOpcode* names, size_t count, uint8_t opcode)
+		{
+			for(size_t i = 0; i < count; ++i)
+				if(names[i].first == opcode) return names[i].second;
+			return nullptr;
+		}
+
+		std::string hex(uint8_t opcode)
+		{
+			char text[8];
+			std::snprintf(text, sizeof(text), "0x%02X", opcode);
+			return text;
+		}
+
+		void writeTable(std::FILE* fp, const char* title, const OpcodeStats::Counter* counters,
+			std::string (*name)(uint8_t))
+		{
+			uint64_t totalExecutions = 0, totalCycles = 0;
+			std::vector<size_t> order;
+			for(size_t i = 0; i < OpcodeStats::OPCODES; ++i) {
+				totalExecutions += counters[i].executions;
+				totalCycles += counters[i].cycles;
+				if(counters[i].executions) order.push_back(i);
+			}
+			std::stable_sort(order.begin(), order.end(), [counters](size_t a, size_t b) {
+				return counters[a].executions > counters[b].executions;
+			});
+
+			fprintf(fp, "%s: %llu executions, %llu cycles\n", title,
+				static_cast<unsigned long long>(totalExecutions), static_cast<unsigned long long>(totalCycles));
+			fprintf(fp, "%-6s %-16s %14s %7s %14s %7s   executions taking 4/8/12/16/20/24/other cycles\n",
+				"opcode", "name", "executions", "%", "cycles", "%");
+			for(size_t i : order) {
+				const OpcodeStats::Counter& counter = counters[i];
+				fprintf(fp, "%-6s %-16s %14llu %6.2f%% %14llu %6.2f%%  ", hex(static_cast<uint8_t>(i)).c_str(),
+					name(static_cast<uint8_t>(i)).c_str(),
+					static_cast<unsigned long long>(counter.executions), 100.0 * counter.executions / totalExecutions,
+					static_cast<unsigned long long>(counter.cycles), totalCycles ? 100.0 * counter.cycles / totalCycles : 0.0);
+				for(size_t bucket = 0; bucket < OpcodeStats::CYCLE_BUCKETS; ++bucket)
+					fprintf(fp, " %llu", static_cast<unsigned long long>(counter.histogram[bucket]));
+				fprintf(fp, "\n");
+			}
+		}
+	}
+
+	void OpcodeStats::reset()
+	{
+		std::fill(std::begin(counters), std::end(counters), Counter{});
+		std::fill(std::begin(cbCounters), std::end(cbCounters), Counter{});
+	}
+
+	std::string OpcodeStats::getName(uint8_t opcode)
+	{
+		const char* name = lookup(OPCODE_NAMES, std::size(OPCODE_NAMES), opcode);
+		return name ? name : hex(opcode);
+	}
+
+	std::string OpcodeStats::getCBName(uint8_t opcode)
+	{
+		// BIT, RES and SET (0x40 up) are only named for bit 0, as BIT_b_B etc.
+		uint8_t named = opcode >= 0x40 ? opcode & 0xC7 : opcode;
+		const char* name = lookup(CB_OPCODE_NAMES, std::size(CB_OPCODE_NAMES), named);
+		if(!name) return hex(opcode);
+		std::string bitName = name;
+		size_t b = bitName.find("_b_");
+		if(b != std::string::npos)
+			bitName[b + 1] = static_cast<char>('0' + ((opcode >> 3) & 0x07));
+		return bitName;
+	}
+
+	bool OpcodeStats::writeReport(const std::string& path) const
+	{
+		std::FILE* fp = std::fopen(path.c_str(), "w");
+		if(!fp) {
+			fprintf(stderr, "Failed to open opcode report: %s\n", path.c_str());
+			return false;
+		}
+		writeTable(fp, "Opcodes", counters, getName);
+		fprintf(fp, "\n");
+		writeTable(fp, "CB prefixed opcodes", cbCounters, getCBName);
+		return std::fclose(fp) == 0;
+	}
+}
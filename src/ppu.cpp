@@ -0,0 +1,263 @@
+#include "../include/ppu.hpp"
+#include "../include/mem.hpp"
+#include "../include/reservedAddresses.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace gb_emu
+{
+	namespace
+	{
+		// ARGB8888 for the four DMG shades, lightest first
+		constexpr uint32_t SHADES[4] = { 0xFFFFFFFF, 0xFFAAAAAA, 0xFF555555, 0xFF000000 };
+
+		enum LCDControl : uint8_t {
+			BG_ENABLE = 1 << 0,
+			OBJ_ENABLE = 1 << 1,
+			OBJ_TALL = 1 << 2,
+			BG_TILE_MAP = 1 << 3,
+			TILE_DATA_SELECT = 1 << 4,
+			WINDOW_ENABLE = 1 << 5,
+			WINDOW_TILE_MAP = 1 << 6,
+			LCD_ENABLE = 1 << 7,
+		};
+
+		enum Interrupt : uint8_t {
+			VBLANK_INTERRUPT = 1 << 0,
+			STAT_INTERRUPT = 1 << 1,
+		};
+
+		constexpr uint32_t OAM_SCAN_CYCLES = 80;
+		constexpr uint32_t TRANSFER_CYCLES = 172;
+
+		/**
+		 * Gets the colour number (0-3) of pixel x (0 = leftmost) from a tile row's two bytes
+		 */
+		inline uint8_t tilePixel(const uint8_t* row, uint8_t x)
+		{
+			uint8_t bit = 7 - x;
+			return ((row[0] >> bit) & 1) | (((row[1] >> bit) & 1) << 1);
+		}
+	}
+
+	PPU::PPU(MMU& mem) : mem(mem)
+	{
+	}
+
+	void PPU::saveState(State& state) const
+	{
+		state.lineCycles = lineCycles;
+		state.ly = ly;
+		state.windowLine = windowLine;
+		state.mode = mode;
+		state.enabled = enabled;
+		std::copy(shades.begin(), shades.end(), state.shades);
+	}
+
+	void PPU::loadState(const State& state)
+	{
+		lineCycles = state.lineCycles;
+		ly = state.ly;
+		windowLine = state.windowLine;
+		mode = state.mode;
+		enabled = state.enabled;
+		for(size_t i = 0; i < shades.size(); ++i)
+			shades[i] = state.shades[i] & 0x3;
+		framebufferCurrent = false;
+	}
+
+	const uint32_t* PPU::getFramebuffer() const
+	{
+		if(!framebuffer)
+			framebuffer = std::make_unique<uint32_t[]>(shades.size());
+		if(!framebufferCurrent) {
+			for(size_t i = 0; i < shades.size(); ++i)
+				framebuffer[i] = SHADES[shades[i]];
+			framebufferCurrent = true;
+		}
+		return framebuffer.get();
+	}
+
+	bool PPU::step(uint32_t cycles)
+	{
+		bool frameDone = false;
+		uint8_t lcdc = mem.getIORegister(LCD_CONTROL);
+
+		if(!(lcdc & LCD_ENABLE)) {
+			// With the LCD off LY stays at 0 and the screen is blank, but we keep
+			// counting whole frames so the frontend still gets a steady frame rate
+			if(enabled) {
+				enabled = false;
+				lineCycles = 0;
+				windowLine = 0;
+				setLY(0);
+				setMode(PPUMode::HBLANK);
+				shades.fill(0);
+				framebufferCurrent = false;
+			}
+			lineCycles += cycles;
+			if(lineCycles >= CYCLES_PER_FRAME) {
+				lineCycles -= CYCLES_PER_FRAME;
+				frameDone = true;
+			}
+			return frameDone;
+		}
+		if(!enabled) {
+			enabled = true;
+			lineCycles = 0;
+			setLY(0);
+			setMode(PPUMode::OAM_SCAN);
+		}
+
+		lineCycles += cycles;
+		for(;;) {
+			if(mode == PPUMode::OAM_SCAN && lineCycles >= OAM_SCAN_CYCLES) {
+				setMode(PPUMode::TRANSFER);
+			}
+			else if(mode == PPUMode::TRANSFER && lineCycles >= OAM_SCAN_CYCLES + TRANSFER_CYCLES) {
+				renderScanline();
+				setMode(PPUMode::HBLANK);
+			}
+			else if(lineCycles >= CYCLES_PER_LINE) {
+				lineCycles -= CYCLES_PER_LINE;
+				uint8_t next = static_cast<uint8_t>((ly + 1) % LINES_PER_FRAME);
+				setLY(next);
+				if(next == SCREEN_HEIGHT) {
+					setMode(PPUMode::VBLANK);
+					requestInterrupt(VBLANK_INTERRUPT);
+					frameDone = true;
+				}
+				else if(next == 0) {
+					windowLine = 0;
+					setMode(PPUMode::OAM_SCAN);
+				}
+				else if(next < SCREEN_HEIGHT) {
+					setMode(PPUMode::OAM_SCAN);
+				}
+			}
+			else {
+				break;
+			}
+		}
+		return frameDone;
+	}
+
+	void PPU::setMode(PPUMode m)
+	{
+		mode = m;
+		uint8_t stat = mem.getIORegister(LCD_STATUS);
+		mem.setIORegister(LCD_STATUS, (stat & ~toUType(PPUMode::MASK)) | toUType(m));
+
+		// STAT bits 3-5 enable an interrupt on entering hblank, vblank and OAM scan
+		if(m != PPUMode::TRANSFER && (stat & (0x08 << toUType(m))))
+			requestInterrupt(STAT_INTERRUPT);
+	}
+
+	void PPU::setLY(uint8_t line)
+	{
+		ly = line;
+		mem.setIORegister(LCD_Y, line);
+
+		// STAT bit 2 reports LY == LYC, and bit 6 enables an interrupt for it
+		uint8_t stat = mem.getIORegister(LCD_STATUS);
+		bool coincidence = line == mem.getIORegister(LCD_Y_COMPARE);
+		mem.setIORegister(LCD_STATUS, coincidence ? (stat | 0x04) : (stat & ~0x04));
+		if(coincidence && (stat & 0x40))
+			requestInterrupt(STAT_INTERRUPT);
+	}
+
+	void PPU::requestInterrupt(uint8_t bit)
+	{
+		mem.setIORegister(INTERRUPT_FLAG, mem.getIORegister(INTERRUPT_FLAG) | bit);
+	}
+
+	void PPU::renderScanline()
+	{
+		uint8_t lcdc = mem.getIORegister(LCD_CONTROL);
+		uint8_t* line = &shades[ly * SCREEN_WIDTH];
+		uint8_t colourIds[SCREEN_WIDTH] = {};
+
+		if(lcdc & BG_ENABLE) {
+			renderBackground(lcdc, colourIds);
+			if(lcdc & WINDOW_ENABLE)
+				renderWindow(lcdc, colourIds);
+		}
+
+		uint8_t bgp = mem.getIORegister(BG_PALETTE);
+		for(size_t x = 0; x < SCREEN_WIDTH; ++x) {
+			line[x] = (bgp >> (colourIds[x] * 2)) & 0x3;
+		}
+		framebufferCurrent = false;
+
+		if(lcdc & OBJ_ENABLE)
+			renderSprites(lcdc, colourIds, line);
+	}
+
+	void PPU::renderBackground(uint8_t lcdc, uint8_t* colourIds)
+	{
+		uint8_t y = static_cast<uint8_t>(ly + mem.getIORegister(SCROLL_Y));
+		uint8_t scx = mem.getIORegister(SCROLL_X);
+		const uint8_t* row = mem.getTileMapCache().row((lcdc & BG_TILE_MAP) ? 1 : 0, y,
+			lcdc & TILE_DATA_SELECT, mem.getRegion(VRAM_BANK, VRAM_SIZE));
+
+		// The layer wraps horizontally, so this is at most two copies
+		size_t first = std::min(SCREEN_WIDTH, TileMapCache::LAYER_SIZE - scx);
+		std::memcpy(colourIds, row + scx, first);
+		std::memcpy(colourIds + first, row, SCREEN_WIDTH - first);
+	}
+
+	void PPU::renderWindow(uint8_t lcdc, uint8_t* colourIds)
+	{
+		uint8_t wy = mem.getIORegister(WINDOW_Y);
+		int wx = static_cast<int>(mem.getIORegister(WINDOW_X)) - 7;
+		if(ly < wy || wx >= static_cast<int>(SCREEN_WIDTH)) return;
+
+		const uint8_t* row = mem.getTileMapCache().row((lcdc & WINDOW_TILE_MAP) ? 1 : 0, windowLine,
+			lcdc & TILE_DATA_SELECT, mem.getRegion(VRAM_BANK, VRAM_SIZE));
+		// WX below 7 shifts the window's left edge off screen
+		if(wx < 0)
+			std::memcpy(colourIds, row - wx, SCREEN_WIDTH);
+		else
+			std::memcpy(colourIds + wx, row, SCREEN_WIDTH - wx);
+		++windowLine;
+	}
+
+	void PPU::renderSprites(uint8_t lcdc, const uint8_t* colourIds, uint8_t* line)
+	{
+		const OAMIndex::LineSprites& sprites = mem.getOAMIndex().line(ly);
+		if(sprites.count == 0) return;
+
+		const uint8_t* oam = mem.getRegion(OAM_TABLE, OAM_SIZE);
+		uint8_t height = (lcdc & OBJ_TALL) ? 16 : 8;
+		uint8_t obp[2] = { mem.getIORegister(OBJ_PALETTE_0), mem.getIORegister(OBJ_PALETTE_1) };
+		// Sprites are in priority order, so the first one to draw a pixel wins it
+		bool claimed[SCREEN_WIDTH] = {};
+
+		for(uint8_t i = 0; i < sprites.count; ++i) {
+			const uint8_t* entry = oam + sprites.sprites[i] * 4;
+			int spriteX = static_cast<int>(entry[1]) - 8;
+			uint8_t tile = entry[2];
+			uint8_t attributes = entry[3];
+			bool behindBG = attributes & 0x80;
+			bool flipY = attributes & 0x40;
+			bool flipX = attributes & 0x20;
+			uint8_t palette = obp[(attributes >> 4) & 1];
+
+			uint8_t row = static_cast<uint8_t>(ly + 16 - entry[0]);
+			if(flipY) row = height - 1 - row;
+			if(height == 16) tile &= 0xFE;
+			const uint8_t* data = mem.getRegion(TILE_DATA_UNSIGNED + tile * 16 + row * 2, 2);
+
+			for(uint8_t px = 0; px < 8; ++px) {
+				int x = spriteX + px;
+				if(x < 0 || x >= static_cast<int>(SCREEN_WIDTH) || claimed[x]) continue;
+				uint8_t colour = tilePixel(data, flipX ? 7 - px : px);
+				// Colour 0 is transparent for sprites
+				if(colour == 0) continue;
+				claimed[x] = true;
+				if(behindBG && colourIds[x] != 0) continue;
+				line[x] = (palette >> (colour * 2)) & 0x3;
+			}
+		}
+	}
+}
@@ -0,0 +1,117 @@
+#include "../include/profiler.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace gb_emu
+{
+	namespace
+	{
+		/**
+		 * Symbols only cover addresses in the same region as them: a ROM
+		 * bank, or an 8 KB block of RAM
+		 */
+		inline uint32_t regionOf(uint32_t location)
+		{
+			uint16_t addr = location & 0xFFFF;
+			return (location & 0xFFFF0000) | (addr < 0x8000 ? addr >> 14 : addr >> 13);
+		}
+	}
+
+	Profiler::Profiler(uint32_t interval) :
+		interval(std::max<uint32_t>(interval, 1))
+	{
+		stack.reserve(MAX_DEPTH);
+	}
+
+	bool Profiler::loadSymbols(const std::string& path)
+	{
+		std::FILE* fp = std::fopen(path.c_str(), "r");
+		if(!fp) {
+			fprintf(stderr, "Can't open symbol file: %s\n", path.c_str());
+			return false;
+		}
+		char line[512];
+		while(std::fgets(line, sizeof(line), fp)) {
+			line[std::strcspn(line, ";\r\n")] = '\0';
+			char* end = nullptr;
+			unsigned long bank = std::strtoul(line, &end, 16);
+			if(end == line || *end != ':') continue;
+			char* addrStart = end + 1;
+			unsigned long addr = std::strtoul(addrStart, &end, 16);
+			if(end == addrStart || addr > 0xFFFF) continue;
+			while(*end == ' ' || *end == '\t') ++end;
+			if(*end == '\0') continue;
+			char* nameEnd = end + std::strcspn(end, " \t");
+			symbols.push_back({ locate(static_cast<uint16_t>(bank), static_cast<uint16_t>(addr)), std::string(end, nameEnd) });
+		}
+		std::fclose(fp);
+		std::stable_sort(symbols.begin(), symbols.end(),
+			[](const Symbol& a, const Symbol& b) { return a.location < b.location; });
+		return true;
+	}
+
+	void Profiler::onCall(uint16_t bank, uint16_t site, uint16_t sp)
+	{
+		if(stack.size() < MAX_DEPTH)
+			stack.push_back({ locate(bank, site), sp });
+	}
+
+	void Profiler::onReturn(uint16_t sp)
+	{
+		// Frames at or below the return address are finished, including any whose return address was dropped
+		while(!stack.empty() && stack.back().sp <= sp)
+			stack.pop_back();
+	}
+
+	void Profiler::sample(uint16_t bank, uint16_t pc, bool halted, uint64_t weight)
+	{
+		key.clear();
+		for(const Frame& frame : stack)
+			key.push_back(frame.location);
+		key.push_back(locate(bank, pc));
+		if(halted) key.push_back(HALTED);
+
+		auto it = samples.find(key);
+		if(it == samples.end())
+			it = samples.emplace(key, 0).first;
+		it->second += weight * interval;
+		sampleCount += weight;
+	}
+
+	std::string Profiler::describe(uint32_t location) const
+	{
+		auto it = std::upper_bound(symbols.begin(), symbols.end(), location,
+			[](uint32_t l, const Symbol& s) { return l < s.location; });
+		if(it != symbols.begin() && regionOf((it - 1)->location) == regionOf(location))
+			return (it - 1)->name;
+		char text[16];
+		std::snprintf(text, sizeof(text), "%02x:%04x", location >> 16, location & 0xFFFF);
+		return text;
+	}
+
+	bool Profiler::writeFolded(const std::string& path) const
+	{
+		// Different PCs in one routine fold into the same line once named
+		std::map<std::string, uint64_t> folded;
+		for(const auto& entry : samples) {
+			const std::vector<uint32_t>& locations = entry.first;
+			std::string line;
+			for(size_t i = 0; i < locations.size(); ++i) {
+				if(i) line += ';';
+				line += locations[i] == HALTED ? "[halted]" : describe(locations[i]);
+			}
+			folded[line] += entry.second;
+		}
+
+		std::FILE* fp = std::fopen(path.c_str(), "w");
+		if(!fp) {
+			fprintf(stderr, "Failed to open profile for writing: %s\n", path.c_str());
+			return false;
+		}
+		for(const auto& entry : folded)
+			fprintf(fp, "%s %llu\n", entry.first.c_str(), static_cast<unsigned long long>(entry.second));
+		return std::fclose(fp) == 0;
+	}
+}
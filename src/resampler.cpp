@@ -0,0 +1,209 @@
+#include "../include/resampler.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#ifdef GB_EMU_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace gb_emu
+{
+	namespace
+	{
+		// Bits of the 32 bit fraction which select the phase
+		constexpr int PHASE_SHIFT = 32 - 8;
+		static_assert((1 << (32 - PHASE_SHIFT)) == Resampler::PHASES, "PHASE_SHIFT must match PHASES");
+		static_assert(Resampler::TAPS % 4 == 0, "The SSE2 path works in groups of four taps");
+
+		inline int16_t toSample(float value)
+		{
+			value = std::min(std::max(value, -32768.0f), 32767.0f);
+			return static_cast<int16_t>(std::lrint(value));
+		}
+	}
+
+	Resampler::Resampler(uint32_t inputRate, uint32_t outputRate, bool simd) :
+		// Half the filter's width of silence, so the first output is centred on the first input
+		left(TAPS / 2, 0.0f),
+		right(TAPS / 2, 0.0f),
+		baseStep(static_cast<double>(inputRate) / outputRate),
+#ifdef GB_EMU_SSE2
+		simd(simd)
+#else
+		simd(false)
+#endif
+	{
+		// Downsampling has to cut off below the output's Nyquist frequency
+		buildKernel(0.9 * std::min(1.0, static_cast<double>(outputRate) / inputRate));
+		setRateAdjust(0);
+	}
+
+	void Resampler::buildKernel(double cutoff)
+	{
+		// Blackman windowed sinc, cutoff as a fraction of the input's Nyquist
+		// frequency. Each phase is normalised to unity gain
+		const double pi = 3.14159265358979323846;
+		for(int phase = 0; phase <= PHASES; ++phase) {
+			double taps[TAPS];
+			double sum = 0;
+			for(int k = 0; k < TAPS; ++k) {
+				double x = k - (TAPS / 2 - 1) - static_cast<double>(phase) / PHASES;
+				double sinc = x == 0 ? 1.0 : std::sin(pi * cutoff * x) / (pi * cutoff * x);
+				double w = x / TAPS;
+				double window = (std::abs(w) > 0.5) ? 0 : 0.42 + 0.5 * std::cos(2 * pi * w) + 0.08 * std::cos(4 * pi * w);
+				taps[k] = sinc * window;
+				sum += taps[k];
+			}
+			for(int k = 0; k < TAPS; ++k)
+				kernel[phase][k] = static_cast<float>(taps[k] / sum);
+		}
+	}
+
+	void Resampler::write(const int16_t* in, size_t frames)
+	{
+		size_t start = left.size();
+		left.resize(start + frames);
+		right.resize(start + frames);
+		for(size_t i = 0; i < frames; ++i) {
+			left[start + i] = in[i * 2];
+			right[start + i] = in[i * 2 + 1];
+		}
+	}
+
+	size_t Resampler::read(int16_t* out, size_t frames)
+	{
+#ifdef GB_EMU_SSE2
+		size_t written = simd ? readSSE2(out, frames) : readScalar(out, frames);
+#else
+		size_t written = readScalar(out, frames);
+#endif
+		discardUsed();
+		return written;
+	}
+
+	size_t Resampler::inputFramesNeeded(size_t frames) const
+	{
+		if(frames == 0) return 0;
+		// The last output frame starts at this input frame, and needs TAPS from there
+		size_t last = readIndex + static_cast<size_t>((fraction + (frames - 1) * step) >> 32);
+		size_t needed = last + TAPS;
+		return needed > left.size() ? needed - left.size() : 0;
+	}
+
+	size_t Resampler::maxInputFrames(size_t frames) const
+	{
+		if(frames == 0) return 0;
+		// inputFramesNeeded with nothing buffered, the largest fraction and the fastest step
+		return static_cast<size_t>(std::ceil(frames * baseStep * (1 + MAX_RATE_ADJUST))) + TAPS + 1;
+	}
+
+	void Resampler::reserve(size_t frames)
+	{
+		// read leaves fewer than TAPS frames unused, which the next write adds to
+		left.reserve(maxInputFrames(frames) + TAPS);
+		right.reserve(maxInputFrames(frames) + TAPS);
+	}
+
+	void Resampler::setRateAdjust(double adjust)
+	{
+		rateAdjust = std::min(std::max(adjust, -MAX_RATE_ADJUST), MAX_RATE_ADJUST);
+		step = static_cast<uint64_t>(std::llround(baseStep * (1 + rateAdjust) * 4294967296.0));
+	}
+
+	void Resampler::updateRate(size_t buffered, size_t target)
+	{
+		if(target == 0) return;
+		// Proportional control, smoothed so bursty producers don't make the
+		// pitch wobble. A buffer at twice the target gets the full adjustment
+		double error = (static_cast<double>(buffered) - target) / target;
+		double wanted = std::min(std::max(error, -1.0), 1.0) * MAX_RATE_ADJUST;
+		setRateAdjust(rateAdjust + (wanted - rateAdjust) * 0.05);
+	}
+
+	void Resampler::setVolume(float left, float right)
+	{
+		volumeLeft = left;
+		volumeRight = right;
+	}
+
+	size_t Resampler::readScalar(int16_t* out, size_t frames)
+	{
+		size_t written = 0;
+		for(; written < frames && readIndex + TAPS <= left.size(); ++written) {
+			const float* h0 = kernel[fraction >> PHASE_SHIFT];
+			const float* h1 = h0 + TAPS;
+			const float* l = &left[readIndex];
+			const float* r = &right[readIndex];
+			float l0 = 0, l1 = 0, r0 = 0, r1 = 0;
+			for(int k = 0; k < TAPS; ++k) {
+				l0 += h0[k] * l[k];
+				l1 += h1[k] * l[k];
+				r0 += h0[k] * r[k];
+				r1 += h1[k] * r[k];
+			}
+			// Interpolate between the two nearest phases
+			float between = (fraction & ((1u << PHASE_SHIFT) - 1)) * (1.0f / (1u << PHASE_SHIFT));
+			out[written * 2] = toSample((l0 + (l1 - l0) * between) * volumeLeft);
+			out[written * 2 + 1] = toSample((r0 + (r1 - r0) * between) * volumeRight);
+			advance(1);
+		}
+		return written;
+	}
+
+#ifdef GB_EMU_SSE2
+	size_t Resampler::readSSE2(int16_t* out, size_t frames)
+	{
+		const __m128 volume = _mm_setr_ps(volumeLeft, volumeRight, 0, 0);
+		size_t written = 0;
+		for(; written < frames && readIndex + TAPS <= left.size(); ++written) {
+			const float* h0 = kernel[fraction >> PHASE_SHIFT];
+			const float* h1 = h0 + TAPS;
+			const float* l = &left[readIndex];
+			const float* r = &right[readIndex];
+			__m128 l0 = _mm_setzero_ps(), r0 = _mm_setzero_ps();
+			__m128 l1 = _mm_setzero_ps(), r1 = _mm_setzero_ps();
+			for(int k = 0; k < TAPS; k += 4) {
+				__m128 a = _mm_load_ps(h0 + k);
+				__m128 b = _mm_load_ps(h1 + k);
+				__m128 x = _mm_loadu_ps(l + k);
+				__m128 y = _mm_loadu_ps(r + k);
+				l0 = _mm_add_ps(l0, _mm_mul_ps(a, x));
+				r0 = _mm_add_ps(r0, _mm_mul_ps(a, y));
+				l1 = _mm_add_ps(l1, _mm_mul_ps(b, x));
+				r1 = _mm_add_ps(r1, _mm_mul_ps(b, y));
+			}
+			// Horizontal sums of all four accumulators at once, giving
+			// { l0, r0, l1, r1 }
+			__m128 s0 = _mm_add_ps(_mm_unpacklo_ps(l0, r0), _mm_unpackhi_ps(l0, r0));
+			__m128 s1 = _mm_add_ps(_mm_unpacklo_ps(l1, r1), _mm_unpackhi_ps(l1, r1));
+			__m128 sums = _mm_add_ps(_mm_movelh_ps(s0, s1), _mm_movehl_ps(s1, s0));
+
+			float between = (fraction & ((1u << PHASE_SHIFT) - 1)) * (1.0f / (1u << PHASE_SHIFT));
+			__m128 next = _mm_movehl_ps(sums, sums);
+			__m128 mixed = _mm_add_ps(sums, _mm_mul_ps(_mm_sub_ps(next, sums), _mm_set1_ps(between)));
+			mixed = _mm_mul_ps(mixed, volume);
+			// Round to nearest and saturate to int16, as toSample does
+			__m128i packed = _mm_packs_epi32(_mm_cvtps_epi32(mixed), _mm_setzero_si128());
+			int32_t pair = _mm_cvtsi128_si32(packed);
+			std::memcpy(out + written * 2, &pair, sizeof(pair));
+			advance(1);
+		}
+		return written;
+	}
+#endif
+
+	void Resampler::advance(size_t frames)
+	{
+		uint64_t position = fraction + frames * step;
+		readIndex += static_cast<size_t>(position >> 32);
+		fraction = static_cast<uint32_t>(position);
+	}
+
+	void Resampler::discardUsed()
+	{
+		size_t used = std::min(readIndex, left.size());
+		left.erase(left.begin(), left.begin() + used);
+		right.erase(right.begin(), right.begin() + used);
+		readIndex -= used;
+	}
+}
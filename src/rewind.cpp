@@ -0,0 +1,192 @@
+#include "../include/rewind.hpp"
+#include "../include/vm.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+namespace gb_emu
+{
+	namespace
+	{
+		void putVarint(std::vector<uint8_t>& out, size_t value)
+		{
+			do {
+				uint8_t byte = value & 0x7F;
+				value >>= 7;
+				out.push_back(value ? byte | 0x80 : byte);
+			} while(value);
+		}
+
+		size_t getVarint(const uint8_t*& in)
+		{
+			size_t value = 0;
+			int shift = 0;
+			uint8_t byte;
+			do {
+				byte = *in++;
+				value |= static_cast<size_t>(byte & 0x7F) << shift;
+				shift += 7;
+			} while(byte & 0x80);
+			return value;
+		}
+
+		/**
+		 * Encodes a XOR b as pairs of (zero run length, literal length)
+		 * followed by the literal bytes
+		 */
+		void encodeXOR(const uint8_t* a, const uint8_t* b, size_t size, std::vector<uint8_t>& out)
+		{
+			out.clear();
+			size_t pos = 0;
+			while(pos < size) {
+				size_t zeros = pos;
+				while(zeros < size && a[zeros] == b[zeros]) ++zeros;
+				size_t literals = zeros;
+				// Short runs of zeros cost more to encode than to include
+				while(literals < size && (a[literals] != b[literals]
+					|| (literals + 2 < size && (a[literals + 1] != b[literals + 1] || a[literals + 2] != b[literals + 2]))))
+					++literals;
+				putVarint(out, zeros - pos);
+				putVarint(out, literals - zeros);
+				for(size_t i = zeros; i < literals; ++i)
+					out.push_back(a[i] ^ b[i]);
+				pos = literals;
+			}
+		}
+
+		/**
+		 * XORs an encoded delta into data
+		 */
+		void applyXOR(uint8_t* data, const std::vector<uint8_t>& delta)
+		{
+			const uint8_t* in = delta.data();
+			const uint8_t* end = in + delta.size();
+			while(in < end) {
+				data += getVarint(in);
+				size_t literals = getVarint(in);
+				for(size_t i = 0; i < literals; ++i)
+					*data++ ^= *in++;
+			}
+		}
+	}
+
+	RewindBuffer::RewindBuffer(size_t maxStates, size_t memoryLimit, size_t queueStates) :
+		maxStates(std::max<size_t>(maxStates, 1)),
+		memoryLimit(memoryLimit),
+		freeSlots(queueStates),
+		readySlots(queueStates),
+		newest(std::make_unique<Snapshot>())
+	{
+		for(uint16_t i = 0; i < queueStates; ++i) {
+			slots.push_back(std::make_unique<Snapshot>());
+			freeSlots.push(i);
+		}
+		worker = std::thread(&RewindBuffer::run, this);
+	}
+
+	RewindBuffer::~RewindBuffer()
+	{
+		stopping.store(true, std::memory_order_release);
+		wake.notify_one();
+		worker.join();
+	}
+
+	void RewindBuffer::push(VM& vm)
+	{
+		uint16_t slot;
+		if(!freeSlots.pop(slot)) {
+			skippedStates.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		Snapshot& snapshot = *slots[slot];
+		vm.saveState(snapshot.state);
+		readySlots.push(slot);
+		wake.notify_one();
+	}
+
+	bool RewindBuffer::stepBack(VM& vm)
+	{
+		drain();
+		std::lock_guard<std::mutex> lock(storeMutex);
+		if(!haveNewest) return false;
+		// The newest state is usually the one pushed after the frame just run,
+		// which restoring would leave the VM in as it is
+		if(newest->state.cpu.cycleCounter == vm.getCycleCount()) {
+			if(deltas.empty()) return false;
+			discardNewest();
+		}
+		vm.loadState(newest->state);
+		discardNewest();
+		return true;
+	}
+
+	void RewindBuffer::discardNewest()
+	{
+		if(deltas.empty()) {
+			haveNewest = false;
+			return;
+		}
+		applyXOR(reinterpret_cast<uint8_t*>(newest.get()), deltas.back());
+		deltaBytes -= deltas.back().size();
+		deltas.pop_back();
+	}
+
+	size_t RewindBuffer::size()
+	{
+		drain();
+		std::lock_guard<std::mutex> lock(storeMutex);
+		return haveNewest ? deltas.size() + 1 : 0;
+	}
+
+	size_t RewindBuffer::memoryUsed()
+	{
+		std::lock_guard<std::mutex> lock(storeMutex);
+		return deltaBytes;
+	}
+
+	void RewindBuffer::drain()
+	{
+		// Only the emulation thread pushes, and it's the one waiting here
+		while(readySlots.size() > 0)
+			std::this_thread::yield();
+	}
+
+	void RewindBuffer::run()
+	{
+		for(;;) {
+			// Hold the lock from taking the slot to storing it, so once drain has
+			// seen the queue empty, locking means nothing is half stored
+			std::unique_lock<std::mutex> storeLock(storeMutex);
+			uint16_t slot;
+			if(readySlots.pop(slot)) {
+				store(*slots[slot]);
+				storeLock.unlock();
+				freeSlots.push(slot);
+				continue;
+			}
+			storeLock.unlock();
+			if(stopping.load(std::memory_order_acquire)) break;
+			std::unique_lock<std::mutex> lock(wakeMutex);
+			wake.wait_for(lock, std::chrono::milliseconds(10));
+		}
+	}
+
+	void RewindBuffer::store(const Snapshot& snapshot)
+	{
+		if(haveNewest) {
+			std::vector<uint8_t> delta;
+			encodeXOR(reinterpret_cast<const uint8_t*>(newest.get()), reinterpret_cast<const uint8_t*>(&snapshot), sizeof(Snapshot), delta);
+			delta.shrink_to_fit();
+			deltaBytes += delta.size();
+			deltas.push_back(std::move(delta));
+		}
+		std::memcpy(newest.get(), &snapshot, sizeof(Snapshot));
+		haveNewest = true;
+
+		// The oldest delta only leads to the oldest state, so dropping it forgets that state
+		while(!deltas.empty() && (deltas.size() + 1 > maxStates || deltaBytes > memoryLimit)) {
+			deltaBytes -= deltas.front().size();
+			deltas.pop_front();
+		}
+	}
+}
@@ -0,0 +1,160 @@
+#include "../include/runtimestats.hpp"
+#include "../include/vm.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iterator>
+#include <thread>
+
+namespace gb_emu
+{
+	void StatsSeqlock::store(const RuntimeStats& stats)
+	{
+		uint64_t values[WORDS];
+		std::memcpy(values, &stats, sizeof(values));
+		uint64_t seq = sequence.load(std::memory_order_relaxed);
+		sequence.store(seq + 1, std::memory_order_relaxed);
+		// Readers who see any of the new words must also see the odd sequence
+		std::atomic_thread_fence(std::memory_order_release);
+		for(size_t i = 0; i < WORDS; ++i)
+			words[i].store(values[i], std::memory_order_relaxed);
+		sequence.store(seq + 2, std::memory_order_release);
+	}
+
+	RuntimeStats StatsSeqlock::load() const
+	{
+		uint64_t values[WORDS];
+		for(;;) {
+			uint64_t before = sequence.load(std::memory_order_acquire);
+			if(before & 1) {
+				std::this_thread::yield();
+				continue;
+			}
+			for(size_t i = 0; i < WORDS; ++i)
+				values[i] = words[i].load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if(sequence.load(std::memory_order_relaxed) == before)
+				break;
+		}
+		RuntimeStats stats;
+		std::memcpy(&stats, values, sizeof(stats));
+		return stats;
+	}
+
+	void FrameTimeHistogram::add(uint64_t nanoseconds)
+	{
+		size_t bucket;
+		if(nanoseconds < SUB_BUCKETS) {
+			bucket = static_cast<size_t>(nanoseconds);
+		}
+		else {
+			// The top four bits pick the bucket: the highest set one its power of two, the next three the eighth
+			size_t exponent = 3;
+			while(nanoseconds >> (exponent + 1)) ++exponent;
+			size_t sub = static_cast<size_t>(nanoseconds >> (exponent - 3)) - SUB_BUCKETS;
+			bucket = (exponent - 2) * SUB_BUCKETS + sub;
+		}
+		++buckets[bucket];
+		++count;
+	}
+
+	uint64_t FrameTimeHistogram::percentile(double fraction) const
+	{
+		if(count == 0) return 0;
+		uint64_t rank = std::max<uint64_t>(static_cast<uint64_t>(std::ceil(fraction * count)), 1);
+		uint64_t seen = 0;
+		size_t bucket = 0;
+		for(; bucket < BUCKETS - 1; ++bucket) {
+			seen += buckets[bucket];
+			if(seen >= rank) break;
+		}
+		if(bucket < SUB_BUCKETS) return bucket;
+		size_t exponent = bucket / SUB_BUCKETS + 2;
+		uint64_t width = 1ULL << (exponent - 3);
+		return ((SUB_BUCKETS + bucket % SUB_BUCKETS) << (exponent - 3)) + (width - 1);
+	}
+
+	void FrameTimeHistogram::clear()
+	{
+		std::fill(std::begin(buckets), std::end(buckets), 0);
+		count = 0;
+	}
+
+	StatsMonitor::StatsMonitor(std::chrono::milliseconds interval) :
+		interval(interval),
+		start(Clock::now()),
+		frameStart(start),
+		lastPublish(start),
+		nextPublish(start + this->interval)
+	{
+		published.store(RuntimeStats{});
+	}
+
+	bool StatsMonitor::endFrame(const VM& vm)
+	{
+		Clock::time_point now = Clock::now();
+		frameTimes.add(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now - frameStart).count()));
+		if(now < nextPublish)
+			return false;
+		publish(vm, now);
+		return true;
+	}
+
+	void StatsMonitor::publish(const VM& vm)
+	{
+		publish(vm, Clock::now());
+	}
+
+	void StatsMonitor::publish(const VM& vm, Clock::time_point now)
+	{
+		RuntimeStats stats = {};
+		stats.cycles = vm.getCycleCount();
+		stats.instructions = vm.getInstructionCount();
+		stats.frames = vm.getFrameCount();
+		stats.frameTimeP50 = frameTimes.percentile(0.5);
+		stats.frameTimeP99 = frameTimes.percentile(0.99);
+		stats.droppedFrames = droppedFrames;
+		stats.audioUnderruns = audioUnderruns.load(std::memory_order_relaxed);
+		stats.bankSwitches = vm.getBankSwitches();
+		stats.uptime = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count());
+
+		// Loading a state can take the frame count backwards
+		double seconds = std::chrono::duration<double>(now - lastPublish).count();
+		if(seconds > 0) {
+			uint64_t frames = stats.frames >= lastFrames ? stats.frames - lastFrames : 0;
+			stats.framesPerSecondMilli = static_cast<uint64_t>(frames * 1000 / seconds);
+			stats.bankSwitchesPerSecond = static_cast<uint64_t>((stats.bankSwitches - lastBankSwitches) / seconds);
+		}
+		published.store(stats);
+
+		frameTimes.clear();
+		lastPublish = now;
+		nextPublish = now + interval;
+		lastFrames = stats.frames;
+		lastBankSwitches = stats.bankSwitches;
+	}
+
+	void printStats(std::FILE* fp, const RuntimeStats& stats)
+	{
+		fprintf(fp, "%.1fs: frame %llu, %.1f fps, frame time p50 %.3f ms p99 %.3f ms, %llu dropped, "
+			"%llu audio underruns, %llu bank switches/s, %llu instructions\n",
+			stats.uptime / 1e9, static_cast<unsigned long long>(stats.frames), stats.framesPerSecondMilli / 1000.0,
+			stats.frameTimeP50 / 1e6, stats.frameTimeP99 / 1e6, static_cast<unsigned long long>(stats.droppedFrames),
+			static_cast<unsigned long long>(stats.audioUnderruns), static_cast<unsigned long long>(stats.bankSwitchesPerSecond),
+			static_cast<unsigned long long>(stats.instructions));
+	}
+
+	void writeStatsJSON(std::FILE* fp, const RuntimeStats& stats)
+	{
+		fprintf(fp, "{\"uptime_ns\":%llu,\"cycles\":%llu,\"instructions\":%llu,\"frames\":%llu,"
+			"\"frame_time_p50_ns\":%llu,\"frame_time_p99_ns\":%llu,\"fps\":%.3f,\"dropped_frames\":%llu,"
+			"\"audio_underruns\":%llu,\"bank_switches\":%llu,\"bank_switches_per_second\":%llu}\n",
+			static_cast<unsigned long long>(stats.uptime), static_cast<unsigned long long>(stats.cycles),
+			static_cast<unsigned long long>(stats.instructions), static_cast<unsigned long long>(stats.frames),
+			static_cast<unsigned long long>(stats.frameTimeP50), static_cast<unsigned long long>(stats.frameTimeP99),
+			stats.framesPerSecondMilli / 1000.0, static_cast<unsigned long long>(stats.droppedFrames),
+			static_cast<unsigned long long>(stats.audioUnderruns), static_cast<unsigned long long>(stats.bankSwitches),
+			static_cast<unsigned long long>(stats.bankSwitchesPerSecond));
+		std::fflush(fp);
+	}
+}
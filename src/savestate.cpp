@@ -0,0 +1,60 @@
+#include "../include/savestate.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <memory>
+
+namespace gb_emu
+{
+	bool isValid(const SaveState& state)
+	{
+		return std::equal(std::begin(savestate::MAGIC), std::end(savestate::MAGIC), state.header.magic)
+			&& state.header.version == savestate::VERSION
+			&& state.header.size == sizeof(SaveState);
+	}
+
+	void applyDelta(SaveState& state, const DeltaSaveState& delta)
+	{
+		state.header = delta.header;
+		state.cpu = delta.cpu;
+		MMU::applyDelta(state.mmu, delta.mmu);
+		state.ppu = delta.ppu;
+		state.apu = delta.apu;
+		state.timer = delta.timer;
+		state.joypad = delta.joypad;
+		state.serial = delta.serial;
+	}
+
+	bool writeSaveState(const std::string& path, const SaveState& state)
+	{
+		std::FILE* fp = std::fopen(path.c_str(), "wb");
+		if(!fp) {
+			fprintf(stderr, "Failed to open save-state for writing: %s\n", path.c_str());
+			return false;
+		}
+		bool ok = std::fwrite(&state, sizeof(state), 1, fp) == 1;
+		ok = std::fclose(fp) == 0 && ok;
+		if(!ok) fprintf(stderr, "Failed to write save-state: %s\n", path.c_str());
+		return ok;
+	}
+
+	bool readSaveState(const std::string& path, SaveState& state)
+	{
+		std::FILE* fp = std::fopen(path.c_str(), "rb");
+		if(!fp) {
+			fprintf(stderr, "Failed to open save-state: %s\n", path.c_str());
+			return false;
+		}
+		// Read into a temporary so a bad file doesn't clobber state
+		auto loaded = std::make_unique<SaveState>();
+		bool ok = std::fread(loaded.get(), sizeof(SaveState), 1, fp) == 1;
+		std::fclose(fp);
+		if(!ok || !isValid(*loaded)) {
+			fprintf(stderr, "Not a save-state from this version: %s\n", path.c_str());
+			return false;
+		}
+		std::memcpy(&state, loaded.get(), sizeof(state));
+		return true;
+	}
+}
@@ -0,0 +1,82 @@
+#include "../include/serial.hpp"
+#include "../include/linkcable.hpp"
+#include "../include/mem.hpp"
+#include "../include/reservedAddresses.hpp"
+
+namespace gb_emu
+{
+	namespace
+	{
+		constexpr uint8_t SERIAL_INTERRUPT = 0x08;
+		constexpr uint8_t TRANSFER_START = 0x80;
+		constexpr uint8_t INTERNAL_CLOCK = 0x01;
+	}
+
+	Serial::Serial(MMU& mem, const uint64_t& clock) :
+		mem(mem),
+		clock(clock)
+	{
+	}
+
+	void Serial::schedule()
+	{
+		if(cable)
+			cable->schedule(side);
+		else
+			nextEvent = transferEnd;
+	}
+
+	void Serial::update()
+	{
+		if(cable) {
+			cable->sync(side);
+			return;
+		}
+		if(clock >= transferEnd)
+			finish(0xFF);
+		schedule();
+	}
+
+	void Serial::finish(uint8_t received)
+	{
+		data = received;
+		control &= ~TRANSFER_START;
+		transferEnd = NEVER;
+		mem.setIORegister(INTERRUPT_FLAG, mem.getIORegister(INTERRUPT_FLAG) | SERIAL_INTERRUPT);
+	}
+
+	void Serial::saveState(State& state) const
+	{
+		state = { data, control, transferEnd };
+	}
+
+	void Serial::loadState(const State& state)
+	{
+		data = state.data;
+		control = state.control;
+		transferEnd = state.transferEnd;
+		schedule();
+	}
+
+	uint8_t Serial::readIO(uint16_t addr)
+	{
+		if(addr == SERIAL_DATA) return data;
+		// Unused bits read as 1
+		return 0x7E | control;
+	}
+
+	void Serial::writeIO(uint16_t addr, uint8_t value)
+	{
+		if(addr == SERIAL_DATA) {
+			data = value;
+			return;
+		}
+		control = value & (TRANSFER_START | INTERNAL_CLOCK);
+		transferEnd = NEVER;
+		if(control == (TRANSFER_START | INTERNAL_CLOCK)) {
+			transferEnd = clock + TRANSFER_CYCLES;
+			if(cable) cable->start(side);
+		}
+		schedule();
+	}
+}
@@ -0,0 +1,102 @@
+#include "../include/threadpool.hpp"
+#include <algorithm>
+
+namespace gb_emu
+{
+	namespace
+	{
+		// Which pool, if any, the current thread works for, and its queue in it
+		thread_local const WorkStealingPool* currentPool = nullptr;
+		thread_local size_t currentIndex = 0;
+	}
+
+	WorkStealingPool::WorkStealingPool(size_t threadCount)
+	{
+		if(threadCount == 0)
+			threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+		for(size_t i = 0; i < threadCount; ++i)
+			queues.push_back(std::make_unique<Queue>());
+		for(size_t i = 0; i < threadCount; ++i)
+			threads.emplace_back(&WorkStealingPool::workerLoop, this, i);
+	}
+
+	WorkStealingPool::~WorkStealingPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(sleepMutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for(auto& thread : threads)
+			thread.join();
+	}
+
+	void WorkStealingPool::submit(Task task)
+	{
+		size_t index = currentPool == this ? currentIndex
+			: nextQueue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+		unfinished.fetch_add(1, std::memory_order_relaxed);
+		// Counted before it's visible, so the count never drops below zero
+		{
+			std::lock_guard<std::mutex> lock(sleepMutex);
+			queued.fetch_add(1, std::memory_order_relaxed);
+		}
+		{
+			std::lock_guard<std::mutex> lock(queues[index]->mutex);
+			queues[index]->tasks.push_back(std::move(task));
+		}
+		wake.notify_one();
+	}
+
+	void WorkStealingPool::wait()
+	{
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		idle.wait(lock, [this] { return unfinished.load() == 0; });
+	}
+
+	bool WorkStealingPool::take(size_t index, Task& task)
+	{
+		{
+			Queue& own = *queues[index];
+			std::lock_guard<std::mutex> lock(own.mutex);
+			if(!own.tasks.empty()) {
+				task = std::move(own.tasks.back());
+				own.tasks.pop_back();
+				return true;
+			}
+		}
+		for(size_t i = 1; i < queues.size(); ++i) {
+			Queue& victim = *queues[(index + i) % queues.size()];
+			std::lock_guard<std::mutex> lock(victim.mutex);
+			if(!victim.tasks.empty()) {
+				task = std::move(victim.tasks.front());
+				victim.tasks.pop_front();
+				steals.fetch_add(1, std::memory_order_relaxed);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void WorkStealingPool::workerLoop(size_t index)
+	{
+		currentPool = this;
+		currentIndex = index;
+		for(;;) {
+			Task task;
+			if(take(index, task)) {
+				queued.fetch_sub(1, std::memory_order_relaxed);
+				task();
+				if(unfinished.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+					std::lock_guard<std::mutex> lock(sleepMutex);
+					idle.notify_all();
+				}
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(sleepMutex);
+			wake.wait(lock, [this] { return stopping || queued.load() > 0; });
+			if(stopping && queued.load() == 0) return;
+		}
+	}
+}
@@ -0,0 +1,73 @@
+#include "../include/tilecache.hpp"
+#include "../include/reservedAddresses.hpp"
+#include <algorithm>
+
+namespace gb_emu
+{
+	TileMapCache::TileMapCache()
+	{
+		std::fill(&entryTile[0][0], &entryTile[0][0] + 2 * MAP_SIZE * MAP_SIZE, NO_TILE);
+	}
+
+	void TileMapCache::write(uint16_t addr)
+	{
+		// Map writes are picked up when the entry's tile id is compared, so
+		// only tile data writes need tracking per tile
+		if(addr < TILE_MAP_0) {
+			++tileVersion[(addr - VRAM_BANK) / 16];
+		}
+		++vramVersion;
+	}
+
+	void TileMapCache::invalidate()
+	{
+		std::fill(&entryTile[0][0], &entryTile[0][0] + 2 * MAP_SIZE * MAP_SIZE, NO_TILE);
+		++vramVersion;
+	}
+
+	const uint8_t* TileMapCache::row(uint8_t map, uint8_t y, bool unsignedTileData, const uint8_t* vram)
+	{
+		if(unsignedTileData != lastUnsignedTileData) {
+			lastUnsignedTileData = unsignedTileData;
+			++vramVersion;
+		}
+		if(!layers[map]) {
+			// Left uninitialised, as every entry of a row is drawn before it is first read
+			layers[map].reset(new uint8_t[LAYER_SIZE * LAYER_SIZE]);
+		}
+		uint8_t tileRow = y / 8;
+		if(rowVersion[map][tileRow] != vramVersion) {
+			validateRow(map, tileRow, unsignedTileData, vram);
+			rowVersion[map][tileRow] = vramVersion;
+		}
+		return &layers[map][y * LAYER_SIZE];
+	}
+
+	void TileMapCache::validateRow(uint8_t map, uint8_t tileRow, bool unsignedTileData, const uint8_t* vram)
+	{
+		const uint8_t* mapData = vram + ((map ? TILE_MAP_1 : TILE_MAP_0) - VRAM_BANK);
+		for(uint16_t entry = tileRow * MAP_SIZE; entry < (tileRow + 1) * MAP_SIZE; ++entry) {
+			// Both addressing modes as an index into the 384 tiles at 0x8000
+			uint8_t id = mapData[entry];
+			uint16_t tile = unsignedTileData ? id : static_cast<uint16_t>(256 + static_cast<int8_t>(id));
+			if(entryTile[map][entry] != tile || entryVersion[map][entry] != tileVersion[tile]) {
+				drawEntry(map, entry, tile, vram);
+			}
+		}
+	}
+
+	void TileMapCache::drawEntry(uint8_t map, uint16_t entry, uint16_t tile, const uint8_t* vram)
+	{
+		const uint8_t* data = vram + tile * 16;
+		uint8_t* dst = &layers[map][(entry / MAP_SIZE) * 8 * LAYER_SIZE + (entry % MAP_SIZE) * 8];
+		for(uint8_t y = 0; y < 8; ++y, data += 2, dst += LAYER_SIZE) {
+			uint8_t lo = data[0], hi = data[1];
+			for(uint8_t x = 0; x < 8; ++x) {
+				uint8_t bit = 7 - x;
+				dst[x] = ((lo >> bit) & 1) | (((hi >> bit) & 1) << 1);
+			}
+		}
+		entryTile[map][entry] = tile;
+		entryVersion[map][entry] = tileVersion[tile];
+	}
+}
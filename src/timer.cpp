@@ -0,0 +1,122 @@
+#include "../include/timer.hpp"
+#include "../include/mem.hpp"
+#include "../include/reservedAddresses.hpp"
+
+namespace gb_emu
+{
+	namespace
+	{
+		// Cycles per TIMA increment, indexed by TAC's clock select bits
+		constexpr uint32_t TIMER_PERIODS[4] = { 1024, 16, 64, 256 };
+
+		constexpr uint8_t TIMER_INTERRUPT = 0x04;
+	}
+
+	Timer::Timer(MMU& mem, const uint64_t& clock) :
+		mem(mem),
+		clock(clock),
+		divBase(clock),
+		timaTime(clock)
+	{
+	}
+
+	uint32_t Timer::period() const
+	{
+		return TIMER_PERIODS[tac & 0x3];
+	}
+
+	uint64_t Timer::edgesBetween(uint64_t from, uint64_t to) const
+	{
+		return (to - divBase) / period() - (from - divBase) / period();
+	}
+
+	void Timer::schedule()
+	{
+		if(!enabled()) {
+			nextOverflow = NEVER;
+			return;
+		}
+		// The first increment after timaTime, then one per period until TIMA wraps
+		uint64_t firstEdge = divBase + ((timaTime - divBase) / period() + 1) * period();
+		nextOverflow = firstEdge + static_cast<uint64_t>(0xFF - tima) * period();
+	}
+
+	void Timer::update()
+	{
+		uint64_t now = clock;
+		if(!enabled()) {
+			timaTime = now;
+			return;
+		}
+		while(nextOverflow <= now) {
+			tima = tma;
+			timaTime = nextOverflow;
+			mem.setIORegister(INTERRUPT_FLAG, mem.getIORegister(INTERRUPT_FLAG) | TIMER_INTERRUPT);
+			schedule();
+		}
+		tima = static_cast<uint8_t>(tima + edgesBetween(timaTime, now));
+		timaTime = now;
+	}
+
+	void Timer::saveState(State& state) const
+	{
+		state = { divBase, tima, tma, tac, timaTime, nextOverflow };
+	}
+
+	void Timer::loadState(const State& state)
+	{
+		divBase = state.divBase;
+		tima = state.tima;
+		tma = state.tma;
+		tac = state.tac;
+		timaTime = state.timaTime;
+		nextOverflow = state.nextOverflow;
+	}
+
+	uint8_t Timer::readIO(uint16_t addr)
+	{
+		switch(addr) {
+		case DIVIDER:
+			return static_cast<uint8_t>((clock - divBase) >> 8);
+		case TIMER_COUNTER:
+			update();
+			return tima;
+		case TIMER_MODULO:
+			return tma;
+		case TIMER_CONTROL:
+			return tac | 0xF8;
+		}
+		return 0xFF;
+	}
+
+	void Timer::writeIO(uint16_t addr, uint8_t value)
+	{
+		update();
+		switch(addr) {
+		case DIVIDER:
+		{
+			// Resetting the divider while TIMA's input bit is high is a
+			// falling edge, so counts as an increment
+			bool inputHigh = ((clock - divBase) & (period() / 2)) != 0;
+			divBase = clock;
+			if(enabled() && inputHigh) {
+				if(++tima == 0) {
+					tima = tma;
+					mem.setIORegister(INTERRUPT_FLAG, mem.getIORegister(INTERRUPT_FLAG) | TIMER_INTERRUPT);
+				}
+			}
+			break;
+		}
+		case TIMER_COUNTER:
+			tima = value;
+			break;
+		case TIMER_MODULO:
+			tma = value;
+			break;
+		case TIMER_CONTROL:
+			tac = value & 0x7;
+			break;
+		}
+		schedule();
+	}
+}
@@ -0,0 +1,71 @@
+#include "../include/trace.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <iterator>
+#include <utility>
+
+namespace gb_emu
+{
+	TraceRing::TraceRing(size_t minCapacity, uint64_t startCycles) :
+		lastCycles(startCycles)
+	{
+		size_t capacity = 1;
+		while(capacity < minCapacity) capacity <<= 1;
+		records.resize(capacity);
+		mask = capacity - 1;
+	}
+
+	bool TraceRing::write(const std::string& path, const CPUState& cpu) const
+	{
+		TraceHeader header = {};
+		std::copy(std::begin(trace::MAGIC), std::end(trace::MAGIC), header.magic);
+		header.version = trace::VERSION;
+		header.recordSize = sizeof(TraceRecord);
+		header.records = static_cast<uint32_t>(std::min<uint64_t>(total, records.size()));
+		header.total = total;
+		header.lastCycles = lastCycles;
+		header.cpu = cpu;
+
+		std::FILE* fp = std::fopen(path.c_str(), "wb");
+		if(!fp) {
+			fprintf(stderr, "Failed to open trace for writing: %s\n", path.c_str());
+			return false;
+		}
+		bool ok = std::fwrite(&header, sizeof(header), 1, fp) == 1;
+		// Oldest first: the part of the ring after the newest record, then the part up to it
+		size_t start = static_cast<size_t>(total - header.records) & mask;
+		size_t firstPart = std::min<size_t>(header.records, records.size() - start);
+		ok = ok && std::fwrite(records.data() + start, sizeof(TraceRecord), firstPart, fp) == firstPart;
+		ok = ok && std::fwrite(records.data(), sizeof(TraceRecord), header.records - firstPart, fp) == header.records - firstPart;
+		ok = std::fclose(fp) == 0 && ok;
+		if(!ok) fprintf(stderr, "Failed to write trace: %s\n", path.c_str());
+		return ok;
+	}
+
+	bool readTrace(const std::string& path, TraceHeader& header, std::vector<TraceRecord>& records)
+	{
+		std::FILE* fp = std::fopen(path.c_str(), "rb");
+		if(!fp) {
+			fprintf(stderr, "Failed to open trace: %s\n", path.c_str());
+			return false;
+		}
+		TraceHeader loaded;
+		bool ok = std::fread(&loaded, sizeof(loaded), 1, fp) == 1
+			&& std::equal(std::begin(trace::MAGIC), std::end(trace::MAGIC), loaded.magic)
+			&& loaded.version == trace::VERSION
+			&& loaded.recordSize == sizeof(TraceRecord);
+		std::vector<TraceRecord> loadedRecords;
+		if(ok) {
+			loadedRecords.resize(loaded.records);
+			ok = std::fread(loadedRecords.data(), sizeof(TraceRecord), loaded.records, fp) == loaded.records;
+		}
+		std::fclose(fp);
+		if(!ok) {
+			fprintf(stderr, "Not a trace from this version: %s\n", path.c_str());
+			return false;
+		}
+		header = loaded;
+		records = std::move(loadedRecords);
+		return true;
+	}
+}
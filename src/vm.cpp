@@ -1,35 +1,284 @@
 #include "../include/vm.hpp"
 #include "../include/op_code.hpp"
 #include "../include/reservedAddresses.hpp"
+#include "../include/hash.hpp"
 #include <cassert>
+#include <cstring>
+#include <iterator>
 
 namespace gb_emu
 {
+	// The APU's heap is about 6 KB with output disabled. Opcode counters are a debugging aid, so aren't budgeted for
+	static_assert(sizeof(VM) - sizeof(OpcodeStatsPolicy) + 8 * 1024 <= VM::FOOTPRINT_BUDGET, "VM has outgrown its footprint budget");
+
+	VM::VM(const std::string& romPath) : ppu(mem), apu(cycleCounter), timer(mem, cycleCounter), joypad(mem), serial(mem, cycleCounter)
+	{
+		mapDevices();
+		mem.loadFromFile(romPath);
+	}
+
+	VM::VM(ForkTag) : mem(MMU::ForkTag()), ppu(mem), apu(cycleCounter), timer(mem, cycleCounter), joypad(mem), serial(mem, cycleCounter)
+	{
+		mapDevices();
+	}
+
+	void VM::mapDevices()
+	{
+		mem.mapIO(SOUND_REGISTERS, SOUND_REGISTERS_END, &apu);
+		mem.mapIO(DIVIDER, TIMER_CONTROL, &timer);
+		mem.mapIO(JOYPAD, JOYPAD, &joypad);
+		mem.mapIO(SERIAL_DATA, SERIAL_CONTROL, &serial);
+	}
+
+	std::unique_ptr<VM> VM::fork()
+	{
+		std::unique_ptr<VM> child(new VM(ForkTag()));
+		forkInto(*child);
+		return child;
+	}
+
+	void VM::forkInto(VM& child)
+	{
+		CPUState cpu;
+		saveCPU(cpu);
+		// First, as the APU and timer in child are timed against its clock
+		child.loadCPU(cpu);
+		child.mem.forkFrom(mem);
+
+		PPU::State ppuState;
+		ppu.saveState(ppuState);
+		child.ppu.loadState(ppuState);
+		APU::State apuState;
+		apu.saveState(apuState);
+		child.apu.loadState(apuState);
+		Timer::State timerState;
+		timer.saveState(timerState);
+		child.timer.loadState(timerState);
+		Joypad::State joypadState;
+		joypad.saveState(joypadState);
+		child.joypad.loadState(joypadState);
+		// Not the cable, which joins two particular VMs
+		Serial::State serialState;
+		serial.saveState(serialState);
+		child.serial.loadState(serialState);
+	}
+
+	void VM::setProfiler(Profiler* profiler)
+	{
+		this->profiler = profiler;
+		nextProfileSample = profiler ? cycleCounter + profiler->getInterval() : ~0ULL;
+	}
+
+	void VM::sampleProfile()
+	{
+		// An instruction (or a long DMA) can cover more than one interval
+		uint64_t interval = profiler->getInterval();
+		uint64_t weight = (cycleCounter - nextProfileSample) / interval + 1;
+		nextProfileSample += weight * interval;
+		profiler->sample(mem.getBank(PC), PC, halted, weight);
+	}
+
+	void VM::enableTrace(size_t records)
+	{
+		trace = records ? std::make_unique<TraceRing>(records, cycleCounter) : nullptr;
+	}
+
+	bool VM::dumpTrace(const std::string& path) const
+	{
+		if(!trace) {
+			fprintf(stderr, "Tracing is off, so there's no trace to write\n");
+			return false;
+		}
+		CPUState cpu;
+		saveCPU(cpu);
+		return trace->write(path, cpu);
+	}
+
+	void VM::traceInstruction()
+	{
+		TraceRecord& record = trace->append(cycleCounter);
+		uint16_t pc = PC;
+		record.pc = pc;
+		record.bank = static_cast<uint8_t>(mem.getBank(pc));
+		record.opcode = mem.peekByte(pc);
+		record.operands[0] = mem.peekByte(pc + 1);
+		record.operands[1] = mem.peekByte(pc + 2);
+		std::memcpy(record.registers, registers, sizeof(record.registers));
+	}
+
+	Footprint VM::getFootprint() const
+	{
+		Footprint footprint;
+		footprint.object = sizeof(VM);
+		footprint.heap = mem.getHeapSize() + apu.getHeapSize();
+		footprint.caches = mem.getTileMapCache().getHeapSize() + ppu.getHeapSize();
+		footprint.shared = mem.getSharedSize();
+		footprint.ownedPages = mem.getOwnedPageCount();
+		return footprint;
+	}
+
+	void VM::saveHeader(SaveStateHeader& header) const
+	{
+		std::copy(std::begin(savestate::MAGIC), std::end(savestate::MAGIC), header.magic);
+		header.version = savestate::VERSION;
+		header.size = sizeof(SaveState);
+	}
+
+	void VM::saveCPU(CPUState& cpu) const
+	{
+		std::copy(std::begin(registers), std::end(registers), cpu.registers);
+		cpu.SP = SP;
+		cpu.PC = PC;
+		cpu.cycleCounter = cycleCounter;
+		cpu.interruptEnablePending = interruptEnablePending;
+		cpu.interruptsEnabled = interruptsEnabled;
+		cpu.halted = halted;
+		cpu.frameCount = frameCount;
+		cpu.frameHash = frameHash;
+		cpu.previousFrameHash = previousFrameHash;
+	}
+
+	void VM::loadCPU(const CPUState& cpu)
+	{
+		std::copy(std::begin(cpu.registers), std::end(cpu.registers), registers);
+		SP = cpu.SP;
+		PC = cpu.PC;
+		cycleCounter = cpu.cycleCounter;
+		interruptEnablePending = cpu.interruptEnablePending;
+		interruptsEnabled = cpu.interruptsEnabled;
+		halted = cpu.halted;
+		frameCount = cpu.frameCount;
+		frameHash = cpu.frameHash;
+		previousFrameHash = cpu.previousFrameHash;
+	}
+
+	void VM::saveState(SaveState& state)
+	{
+		saveHeader(state.header);
+		saveCPU(state.cpu);
+		mem.saveState(state.mmu);
+		ppu.saveState(state.ppu);
+		apu.saveState(state.apu);
+		timer.saveState(state.timer);
+		joypad.saveState(state.joypad);
+		serial.saveState(state.serial);
+	}
+
+	void VM::saveDelta(DeltaSaveState& delta)
+	{
+		saveHeader(delta.header);
+		saveCPU(delta.cpu);
+		mem.saveDelta(delta.mmu);
+		ppu.saveState(delta.ppu);
+		apu.saveState(delta.apu);
+		timer.saveState(delta.timer);
+		joypad.saveState(delta.joypad);
+		serial.saveState(delta.serial);
+		mem.markClean();
+	}
+
+	bool VM::loadState(const SaveState& state)
+	{
+		if(!isValid(state)) return false;
+
+		loadCPU(state.cpu);
+		mem.loadState(state.mmu);
+		ppu.loadState(state.ppu);
+		apu.loadState(state.apu);
+		timer.loadState(state.timer);
+		joypad.loadState(state.joypad);
+		serial.loadState(state.serial);
+		if(profiler) {
+			profiler->resetStack();
+			nextProfileSample = cycleCounter + profiler->getInterval();
+		}
+		mem.markClean();
+		return true;
+	}
+
 	ExecuteResult VM::run()
 	{
 		for(;;) {
-			// Do pre instruction stuff
-
-			// Do instruction
-			auto res = fetchDecodeExecute();
+			auto res = runFrame();
 			if(res == ExecuteResult::RUNTIME_ERROR) {
 				fprintf(stderr, "Instruction returned RUNTIME_ERROR\n");
 				assert(false);
 			}
+		}
+		return ExecuteResult();
+	}
+
+	ExecuteResult VM::runFrames(uint64_t budget, uint64_t& frames)
+	{
+		for(frames = 0; frames < budget; ++frames) {
+			auto res = runFrame();
+			if(res != ExecuteResult::OK) return res;
+		}
+		return ExecuteResult::OK;
+	}
+
+	ExecuteResult VM::runFrame()
+	{
+		for(;;) {
+			ExecuteResult res = ExecuteResult::OK;
+			if(step(res) || res != ExecuteResult::OK)
+				return res;
+		}
+	}
 
-			// Do post instruction stuff
-			// Check interrupt enabling
-			interruptEnablePending <<= 1;
-			if(interruptEnablePending & 0x3) {
-				enableInterrupts();
-				interruptEnablePending = 0;
+	bool VM::step(ExecuteResult& result)
+	{
+		// Do pre instruction stuff
+		uint64_t startCycles = cycleCounter;
+
+		// Do instruction
+		if(halted) {
+			cycles(4);
+		}
+		else {
+			result = fetchDecodeExecute();
+			if(result == ExecuteResult::RUNTIME_ERROR) {
+				return false;
 			}
+			++instructionCount;
 		}
-		return ExecuteResult();
+		return finishInstruction(startCycles);
+	}
+
+	bool VM::finishInstruction(uint64_t startCycles)
+	{
+		if(cycleCounter >= nextProfileSample)
+			sampleProfile();
+
+		// Do post instruction stuff
+		// Check interrupt enabling
+		interruptEnablePending <<= 1;
+		if(interruptEnablePending & 0x3) {
+			enableInterrupts();
+			interruptEnablePending = 0;
+		}
+		if(timer.due())
+			timer.update();
+		if(serial.due())
+			serial.update();
+		serviceInterrupts();
+
+		// The APU catches itself up on register access, so only the PPU is stepped
+		uint32_t elapsed = static_cast<uint32_t>(cycleCounter - startCycles);
+		if(ppu.step(elapsed)) {
+			++frameCount;
+			apu.sync();
+			previousFrameHash = frameHash;
+			frameHash = hashBytes(ppu.getShades(), SCREEN_WIDTH * SCREEN_HEIGHT);
+			return true;
+		}
+		return false;
 	}
 
 	ExecuteResult VM::fetchDecodeExecute()
 	{
+		uint64_t startCycles = cycleCounter;
+		if(trace) traceInstruction();
 		uint8_t instruction = fetchByte();
 		switch(toEnum<Opcode_Group>(instruction))
 		{
@@ -217,6 +466,7 @@ namespace gb_emu
 		{
 			if(static_cast<Opcode_Exact>(instruction) == Opcode_Exact::HALT) {
 				// Halt. Power down CPU until interrupt occurs
+				halted = true;
 				cycles(4);
 			}
 			else {
@@ -257,6 +507,7 @@ namespace gb_emu
 			case Opcode_Misc2_Command_Groups::RST_1:
 			case Opcode_Misc2_Command_Groups::RST_2:
 				push_double(PC);
+				profileCall(PC - 1);
 				longJump(instruction & 0x38);
 				cycles(16);
 				break;
@@ -491,6 +742,7 @@ namespace gb_emu
 		default:
 			return ExecuteResult::RUNTIME_ERROR;
 		}
+		opcodeStats.count(instruction, static_cast<uint32_t>(cycleCounter - startCycles));
 		return ExecuteResult::OK;
 	}
 
@@ -610,23 +862,44 @@ namespace gb_emu
 	}
 	void VM::ret()
 	{
+		if(profiler) profiler->onReturn(SP);
 		PC = pop_double();
 	}
 	void VM::call(uint16_t addr)
 	{
 		push_double(PC + 1);
+		// Every caller has fetched the opcode and both bytes of addr
+		profileCall(PC - 3);
 		longJump(addr);
 	}
 	void VM::enableInterrupts()
 	{
-		mem.setByte(INTERRUPT_ENABLE, 1);
+		interruptsEnabled = true;
 	}
 	void VM::disableInterrupts()
 	{
-		mem.setByte(INTERRUPT_ENABLE, 0);
+		interruptsEnabled = false;
+	}
+	void VM::serviceInterrupts()
+	{
+		uint8_t pending = mem.getIORegister(INTERRUPT_FLAG) & mem.getByte(INTERRUPT_ENABLE) & 0x1F;
+		if(!pending) return;
+		halted = false;
+		if(!interruptsEnabled) return;
+
+		// Lowest bit has the highest priority. Handlers are at 0x40, 0x48, ...
+		uint8_t bit = 0;
+		while(!(pending & (1 << bit))) ++bit;
+		mem.setIORegister(INTERRUPT_FLAG, mem.getIORegister(INTERRUPT_FLAG) & ~(1 << bit));
+		interruptsEnabled = false;
+		push_double(PC);
+		profileCall(PC);
+		longJump(0x40 + bit * 8);
+		cycles(20);
 	}
 	void VM::doPrefixCBCommand()
 	{
+		uint64_t startCycles = cycleCounter;
 		uint8_t instruction = fetchByte();
 		Opcode_Register reg = decodeRegister(instruction, true);
 		switch(toEnum<Opcode_Prefix_Group>(instruction))
@@ -704,6 +977,7 @@ namespace gb_emu
 		}
 		}
 		cycles(reg == Opcode_Register::HL ? 16 : 8);
+		opcodeStats.countCB(instruction, static_cast<uint32_t>(cycleCounter - startCycles));
 	}
 	void VM::doArithmeticCommand(Opcode_Arithmetic_Command cmd, uint8_t operand)
 	{
@@ -0,0 +1,132 @@
+#include "../include/vmpool.hpp"
+#include "../include/vm.hpp"
+#include <new>
+#if defined(_UNIX)
+#include <sys/mman.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#endif
+
+namespace gb_emu
+{
+	namespace
+	{
+		constexpr size_t CACHE_LINE = 64;
+		constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+	}
+
+	VMPool::VMPool(size_t capacity, bool wantHugePages) :
+		slotSize((sizeof(VM) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE),
+		slotCount(capacity)
+	{
+		arenaSize = slotSize * slotCount;
+		if(wantHugePages)
+			arenaSize = (arenaSize + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+
+#if defined(_UNIX)
+		void* p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+		// Explicit huge pages, if the administrator has reserved some
+		if(wantHugePages) {
+			p = mmap(nullptr, arenaSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+			hugePages = p != MAP_FAILED;
+		}
+#endif
+		if(p == MAP_FAILED) {
+			p = mmap(nullptr, arenaSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#ifdef MADV_HUGEPAGE
+			// Otherwise ask for transparent huge pages
+			if(p != MAP_FAILED && wantHugePages)
+				hugePages = madvise(p, arenaSize, MADV_HUGEPAGE) == 0;
+#endif
+		}
+		if(p != MAP_FAILED) {
+			arena = static_cast<uint8_t*>(p);
+			mapped = true;
+		}
+#elif defined(_WIN32)
+		void* p = nullptr;
+		// Needs the lock pages in memory privilege, so often isn't available
+		SIZE_T largePage = wantHugePages ? GetLargePageMinimum() : 0;
+		if(largePage) {
+			size_t size = (arenaSize + largePage - 1) / largePage * largePage;
+			p = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+			if(p) {
+				arenaSize = size;
+				hugePages = true;
+			}
+		}
+		if(!p)
+			p = VirtualAlloc(nullptr, arenaSize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+		if(p) {
+			arena = static_cast<uint8_t*>(p);
+			mapped = true;
+		}
+#endif
+		if(!arena)
+			arena = static_cast<uint8_t*>(::operator new(arenaSize, std::align_val_t(CACHE_LINE)));
+
+		// Hand out low slots first, so a part full pool touches less of the arena
+		freeSlots.reserve(slotCount);
+		for(size_t i = slotCount; i > 0; --i)
+			freeSlots.push_back(static_cast<uint32_t>(i - 1));
+	}
+
+	VMPool::~VMPool()
+	{
+		// Every Handle must have been released by now
+		if(!mapped) {
+			::operator delete(arena, std::align_val_t(CACHE_LINE));
+			return;
+		}
+#if defined(_UNIX)
+		munmap(arena, arenaSize);
+#elif defined(_WIN32)
+		VirtualFree(arena, 0, MEM_RELEASE);
+#endif
+	}
+
+	size_t VMPool::size() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return slotCount - freeSlots.size();
+	}
+
+	void* VMPool::allocate()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if(freeSlots.empty()) return nullptr;
+		uint32_t slot = freeSlots.back();
+		freeSlots.pop_back();
+		return arena + slot * slotSize;
+	}
+
+	void VMPool::release(VM* vm)
+	{
+		size_t slot = (reinterpret_cast<uint8_t*>(vm) - arena) / slotSize;
+		vm->~VM();
+		std::lock_guard<std::mutex> lock(mutex);
+		freeSlots.push_back(static_cast<uint32_t>(slot));
+	}
+
+	void VMPool::Deleter::operator()(VM* vm) const
+	{
+		pool->release(vm);
+	}
+
+	VMPool::Handle VMPool::create(const std::string& romPath)
+	{
+		void* slot = allocate();
+		if(!slot) return Handle(nullptr, Deleter{ this });
+		return Handle(new (slot) VM(romPath), Deleter{ this });
+	}
+
+	VMPool::Handle VMPool::fork(VM& parent)
+	{
+		void* slot = allocate();
+		if(!slot) return Handle(nullptr, Deleter{ this });
+		Handle child(new (slot) VM(VM::ForkTag()), Deleter{ this });
+		parent.forkInto(*child);
+		return child;
+	}
+}
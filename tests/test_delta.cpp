@@ -0,0 +1,71 @@
+#include "../bench/bench_rom.hpp"
+#include "../include/savestate.hpp"
+#include "../include/vm.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+namespace
+{
+	// INC A, then LD (nn),A to a few pages of work RAM and VRAM, so every
+	// frame changes some pages but most stay clean
+	const std::vector<uint8_t> PATTERN = {
+		0x3C,
+		0xEA, 0x00, 0xC0,
+		0xEA, 0x80, 0xC7,
+		0xEA, 0x10, 0xD3,
+		0xEA, 0x00, 0x98,
+	};
+
+	constexpr int DELTAS = 40;
+}
+
+/**
+ * Chains saveDelta/applyDelta across many frames, with full saves in
+ * between as rewind and quick save take them, and checks the chained
+ * state matches saveState after every delta
+ */
+int main()
+{
+	std::string path = gb_bench::writeROM("gb_test_delta.gb", gb_bench::loopROM({}, PATTERN));
+	gb_emu::VM vm(path);
+	if(!vm.isLoaded()) {
+		fprintf(stderr, "Can't load %s\n", path.c_str());
+		return EXIT_FAILURE;
+	}
+	for(int i = 0; i < 10; ++i)
+		vm.runFrame();
+
+	// The chain starts from a full save taken straight after a delta
+	auto chained = std::make_unique<gb_emu::SaveState>();
+	auto expected = std::make_unique<gb_emu::SaveState>();
+	auto delta = std::make_unique<gb_emu::DeltaSaveState>();
+	vm.saveDelta(*delta);
+	vm.saveState(*chained);
+
+	size_t pages = 0;
+	for(int i = 0; i < DELTAS; ++i) {
+		// A full save part way must not break the chain
+		vm.runFrame();
+		vm.saveState(*expected);
+		for(int frame = 0; frame < i % 3; ++frame)
+			vm.runFrame();
+
+		vm.saveDelta(*delta);
+		gb_emu::applyDelta(*chained, *delta);
+		vm.saveState(*expected);
+		pages += delta->mmu.pages.size() / gb_emu::MMU::PAGE_SIZE;
+		if(std::memcmp(chained.get(), expected.get(), sizeof(gb_emu::SaveState)) != 0) {
+			fprintf(stderr, "Chained state differs from saveState after delta %d\n", i);
+			return EXIT_FAILURE;
+		}
+	}
+	// Deltas which held every page would pass without testing anything
+	if(pages >= DELTAS * gb_emu::MMU::STATE_PAGES) {
+		fprintf(stderr, "Every delta held every page\n");
+		return EXIT_FAILURE;
+	}
+	printf("%d deltas, %zu pages, all match\n", DELTAS, pages);
+	return 0;
+}
@@ -0,0 +1,149 @@
+#include "../bench/bench_rom.hpp"
+#include "../include/hash.hpp"
+#include "../include/linkcable.hpp"
+#include "../include/savestate.hpp"
+#include "../include/vm.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+
+namespace
+{
+	constexpr uint64_t FRAMES = 300;
+	constexpr int RUNS = 3;
+
+	// Sets SP, enables only the serial interrupt, clears the counters, EI
+	const std::vector<uint8_t> INIT = {
+		0x31, 0xFE, 0xFF,
+		0x3E, 0x08, 0xE0, 0xFF,
+		0x3E, 0x01, 0xE0, 0x80,
+		0xFB,
+	};
+	// Just past INIT
+	constexpr uint16_t LOOP = static_cast<uint16_t>(0x150 + 12);
+
+	/**
+	 * A cartridge which runs INIT then loop at 0x150, with isr on the
+	 * serial interrupt vector
+	 */
+	std::vector<uint8_t> linkROM(std::vector<uint8_t> loop, const std::vector<uint8_t>& isr)
+	{
+		std::vector<uint8_t> rom = gb_bench::blankROM(2);
+		std::copy(isr.begin(), isr.end(), rom.begin() + 0x58);
+		loop.insert(loop.begin(), INIT.begin(), INIT.end());
+		std::copy(loop.begin(), loop.end(), rom.begin() + 0x150);
+		return rom;
+	}
+
+	// Sends the byte at 0xFF80 on its own clock, then HALTs until the
+	// transfer ends. The handler stores what came back plus one to send next
+	const std::vector<uint8_t> MASTER = {
+		0xF0, 0x80, 0xE0, 0x01,
+		0x3E, 0x81, 0xE0, 0x02,
+		0x76, 0x00,
+		0xC3, LOOP & 0xFF, LOOP >> 8,
+	};
+	const std::vector<uint8_t> MASTER_ISR = {
+		0xF0, 0x01, 0x3C, 0xE0, 0x80,
+		0xF0, 0x81, 0x3C, 0xE0, 0x81,
+		0xD9,
+	};
+	// Waits on the other side's clock, and answers each byte with it plus two
+	const std::vector<uint8_t> SLAVE = {
+		0x3E, 0x80, 0xE0, 0x02,
+		0x76, 0x00,
+		0xC3, LOOP & 0xFF, LOOP >> 8,
+	};
+	const std::vector<uint8_t> SLAVE_ISR = {
+		0xF0, 0x01, 0x3C, 0x3C, 0xE0, 0x01,
+		0xF0, 0x81, 0x3C, 0xE0, 0x81,
+		0xD9,
+	};
+
+	/**
+	 * Hash of vm's memory, seeded with its frame hash and cycle count, so
+	 * it differs if the link changed anything or moved anything in time
+	 */
+	uint64_t stateHash(gb_emu::VM& vm)
+	{
+		auto state = std::make_unique<gb_emu::SaveState>();
+		vm.saveState(*state);
+		return gb_emu::hashBytes(state->mmu.memory, sizeof(state->mmu.memory), state->cpu.frameHash ^ state->cpu.cycleCounter);
+	}
+
+	/**
+	 * Links a and b for FRAMES frames. False if either hit a RUNTIME_ERROR
+	 */
+	bool runLinked(const std::string& a, const std::string& b, uint64_t& hashA, uint64_t& hashB)
+	{
+		gb_emu::VM vmA(a);
+		gb_emu::VM vmB(b);
+		if(!vmA.isLoaded() || !vmB.isLoaded()) {
+			fprintf(stderr, "Can't load %s or %s\n", a.c_str(), b.c_str());
+			return false;
+		}
+		gb_emu::ExecuteResult result;
+		{
+			gb_emu::LinkCable cable(vmA, vmB);
+			result = cable.run(FRAMES);
+		}
+		if(result != gb_emu::ExecuteResult::OK) {
+			fprintf(stderr, "Linked run returned RUNTIME_ERROR\n");
+			return false;
+		}
+		hashA = stateHash(vmA);
+		hashB = stateHash(vmB);
+		return true;
+	}
+}
+
+/**
+ * Links a master and a slave cartridge, and checks the link changed
+ * what the master did and every run ends in the same state. Then links
+ * two masters, which should both end as a master with nothing connected
+ * does
+ */
+int main()
+{
+	std::string master = gb_bench::writeROM("gb_test_link_master.gb", linkROM(MASTER, MASTER_ISR));
+	std::string slave = gb_bench::writeROM("gb_test_link_slave.gb", linkROM(SLAVE, SLAVE_ISR));
+
+	gb_emu::VM solo(master);
+	if(!solo.isLoaded()) {
+		fprintf(stderr, "Can't load %s\n", master.c_str());
+		return EXIT_FAILURE;
+	}
+	for(uint64_t frame = 0; frame < FRAMES; ++frame)
+		solo.runFrame();
+	uint64_t alone = stateHash(solo);
+
+	uint64_t first[2] = {};
+	for(int run = 0; run < RUNS; ++run) {
+		uint64_t a, b;
+		if(!runLinked(master, slave, a, b))
+			return EXIT_FAILURE;
+		printf("run %d  %016llx  %016llx\n", run, static_cast<unsigned long long>(a), static_cast<unsigned long long>(b));
+		if(run == 0) {
+			first[0] = a;
+			first[1] = b;
+			if(a == alone) {
+				fprintf(stderr, "The slave made no difference to the master\n");
+				return EXIT_FAILURE;
+			}
+		}
+		else if(a != first[0] || b != first[1]) {
+			fprintf(stderr, "Run %d differs from run 0\n", run);
+			return EXIT_FAILURE;
+		}
+	}
+
+	uint64_t a, b;
+	if(!runLinked(master, master, a, b))
+		return EXIT_FAILURE;
+	if(a != alone || b != alone) {
+		fprintf(stderr, "Two linked masters differ from one with nothing connected\n");
+		return EXIT_FAILURE;
+	}
+	printf("deterministic\n");
+	return 0;
+}
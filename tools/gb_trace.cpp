@@ -0,0 +1,155 @@
+#include "../include/trace.hpp"
+#include "../include/opcodestats.hpp"
+#include "../include/op_code.hpp"
+#include "../include/common.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/**
+ * Decodes a trace written by gb_emu --trace into a listing, oldest
+ * instruction first, with the registers each one started with
+ */
+
+namespace
+{
+	enum TraceRegister { B, C, D, E, H, L, A, F };
+
+	/**
+	 * Operand bytes taken by the instruction named name, from the n and nn
+	 * in its Opcode_Exact name
+	 */
+	int operandBytes(const std::string& name)
+	{
+		size_t start = 0;
+		while(start < name.size()) {
+			size_t end = name.find('_', start);
+			if(end == std::string::npos) end = name.size();
+			std::string part = name.substr(start, end - start);
+			if(part == "nn") return 2;
+			if(part == "n") return 1;
+			start = end + 1;
+		}
+		return 0;
+	}
+
+	/**
+	 * The instruction at record, and how many bytes it takes
+	 */
+	std::string disassemble(const gb_emu::TraceRecord& record, int& length)
+	{
+		char text[48];
+		if(record.opcode == gb_emu::toUType(gb_emu::Opcode_Exact::CB)) {
+			length = 2;
+			std::snprintf(text, sizeof(text), "%s", gb_emu::OpcodeStats::getCBName(record.operands[0]).c_str());
+			return text;
+		}
+		std::string name = gb_emu::OpcodeStats::getName(record.opcode);
+		int operands = operandBytes(name);
+		// STOP is followed by a padding byte
+		length = 1 + (record.opcode == gb_emu::toUType(gb_emu::Opcode_Exact::STOP) ? 1 : operands);
+		if(operands == 2)
+			std::snprintf(text, sizeof(text), "%-12s $%02x%02x", name.c_str(), record.operands[1], record.operands[0]);
+		else if(operands == 1)
+			std::snprintf(text, sizeof(text), "%-12s $%02x", name.c_str(), record.operands[0]);
+		else
+			std::snprintf(text, sizeof(text), "%s", name.c_str());
+		return text;
+	}
+
+	std::string flags(uint8_t f)
+	{
+		std::string text = "----";
+		if(f & 0x80) text[0] = 'Z';
+		if(f & 0x40) text[1] = 'N';
+		if(f & 0x20) text[2] = 'H';
+		if(f & 0x10) text[3] = 'C';
+		return text;
+	}
+
+	void printRegisters(const uint8_t* r)
+	{
+		printf("A=%02x F=%s BC=%02x%02x DE=%02x%02x HL=%02x%02x", r[A], flags(r[F]).c_str(),
+			r[B], r[C], r[D], r[E], r[H], r[L]);
+	}
+
+	void printUsage(const char* exe)
+	{
+		fprintf(stderr,
+			"Usage: %s <trace> [options]\n"
+			"  --last <n>   Only list the last n instructions\n",
+			exe);
+	}
+}
+
+int main(int argc, char *args[])
+{
+	const char* tracePath = nullptr;
+	size_t last = 0;
+	for(int i = 1; i < argc; ++i) {
+		bool hasValue = i + 1 < argc;
+		if(std::strcmp(args[i], "--last") == 0 && hasValue) {
+			last = static_cast<size_t>(std::max(std::atoi(args[++i]), 0));
+		}
+		else if(!tracePath && args[i][0] != '-') {
+			tracePath = args[i];
+		}
+		else {
+			printUsage(args[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if(!tracePath) {
+		printUsage(args[0]);
+		return EXIT_FAILURE;
+	}
+
+	gb_emu::TraceHeader header;
+	std::vector<gb_emu::TraceRecord> records;
+	if(!gb_emu::readTrace(tracePath, header, records))
+		return EXIT_FAILURE;
+
+	// Records hold the cycles since the one before, so count back from the
+	// newest. Past a saturated gap the cycle numbers are only upper bounds
+	std::vector<uint64_t> cycles(records.size());
+	std::vector<bool> exact(records.size());
+	uint64_t cycle = header.lastCycles;
+	bool known = true;
+	for(size_t i = records.size(); i-- > 0;) {
+		cycles[i] = cycle;
+		exact[i] = known;
+		cycle -= std::min<uint64_t>(records[i].cycles, cycle);
+		known = known && records[i].cycles != 0xFFFF;
+	}
+
+	printf("%llu instructions traced, the last %zu kept\n",
+		static_cast<unsigned long long>(header.total), records.size());
+	size_t first = last && last < records.size() ? records.size() - last : 0;
+	for(size_t i = first; i < records.size(); ++i) {
+		const gb_emu::TraceRecord& record = records[i];
+		int length;
+		std::string instruction = disassemble(record, length);
+		std::string bytes;
+		char byte[4];
+		for(int k = 0; k < length; ++k) {
+			std::snprintf(byte, sizeof(byte), "%02x ", k ? record.operands[k - 1] : record.opcode);
+			bytes += byte;
+		}
+		if(record.cycles == 0xFFFF && i > first)
+			printf("              ... 65535 or more cycles ...\n");
+		printf("%c%12llu  %02x:%04x  %-9s %-20s ", exact[i] ? ' ' : '~', static_cast<unsigned long long>(cycles[i]),
+			record.bank, record.pc, bytes.c_str(), instruction.c_str());
+		printRegisters(record.registers);
+		printf("\n");
+	}
+
+	const gb_emu::CPUState& cpu = header.cpu;
+	printf("\nWhen written: cycle %llu, PC=%04x SP=%04x ", static_cast<unsigned long long>(cpu.cycleCounter),
+		cpu.PC, cpu.SP);
+	printRegisters(cpu.registers);
+	printf("%s%s\n", cpu.halted ? ", halted" : "", cpu.interruptsEnabled ? ", interrupts on" : "");
+	return 0;
+}